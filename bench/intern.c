@@ -0,0 +1,48 @@
+//인터닝 마이크로벤치마크: 서로 다른 문자열 N개(기본 100만)를 인터닝한 뒤의 인터닝 구조 메모리와 삽입/조회 시간을 CSV로 출력한다.
+//usage: clox-intern-bench [strings]
+//인터닝한 문자열은 vm.globals.values(GC root)에 넣어 살려둔다. 삽입 시간에는 인터닝 구조가 커지기 직전마다 도는 GC도 포함된다
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "object.h"
+#include "vm.h"
+
+static double nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, const char *argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    char buffer[32];
+
+    initVM();
+
+    double start = nowNs();
+    for (int i = 0; i < count; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "string-%d", i);
+        ObjString *string = copyString(buffer, length); //새 문자열: 조회 실패 후 삽입
+        push(OBJ_VAL(string));
+        writeValueArray(&vm.globals.values, OBJ_VAL(string));
+        pop();
+    }
+    double insertNs = (nowNs() - start) / count;
+
+    start = nowNs();
+    for (int i = 0; i < count; i++) {
+        int length = snprintf(buffer, sizeof(buffer), "string-%d", i);
+        copyString(buffer, length); //이미 인터닝된 문자열: 조회만
+    }
+    double hitNs = (nowNs() - start) / count;
+
+    //버킷 하나 = key 포인터 + 캐시된 hash
+    size_t internBytes = (size_t) vm.strings.capacity * (sizeof(*vm.strings.keys) + sizeof(*vm.strings.hashes));
+    printf("strings,capacity,intern_bytes,heap_bytes,insert_ns,hit_ns\n");
+    printf("%d,%d,%zu,%zu,%.1f,%.1f\n", vm.strings.count, vm.strings.capacity, internBytes,
+           vm.bytesAllocated, insertNs, hitNs);
+
+    freeVM();
+    return 0;
+}
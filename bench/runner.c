@@ -0,0 +1,211 @@
+//벤치마크 runner: 각 스크립트를 N번 실행해서 wall time(min/median/p95), peak RSS, dispatch된 명령어 수를 CSV로 출력한다.
+//usage: clox-bench [-n runs] [-o out.csv] [--baseline file.csv] [--threshold percent] <clox> <script.lox>...
+//-o로 결과 CSV를 파일에도 남기면 다음 실행의 --baseline으로 쓸 수 있다.
+//baseline보다 median이 threshold(%) 이상 느려진 스크립트는 status 열에 regression으로 표시하고 종료 코드 1을 반환한다.
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_BASELINE 256
+
+typedef struct {
+    char script[512];
+    double medianMs;
+} BaselineEntry;
+
+static BaselineEntry baseline[MAX_BASELINE];
+static int baselineCount = 0;
+static FILE *output = NULL; //-o 파일 (없으면 stdout에만 출력)
+
+static void emit(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    if (output != NULL) {
+        va_start(args, format);
+        vfprintf(output, format, args);
+        va_end(args);
+    }
+}
+
+static double nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static bool runOnce(const char *clox, const char *script, bool stats, int errFd,
+                    double *elapsedMs, long *maxRssKb) {
+    //fork/exec 후 wait4로 자식 프로세스의 rusage(ru_maxrss)를 받는다
+    double start = nowMs();
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        dup2(errFd >= 0 ? errFd : devNull, STDERR_FILENO);
+        if (stats) {
+            execl(clox, clox, "--stats", script, (char *) NULL);
+        } else {
+            execl(clox, clox, script, (char *) NULL);
+        }
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) return false;
+    *elapsedMs = nowMs() - start;
+    *maxRssKb = usage.ru_maxrss; // Linux에서는 KB 단위
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static long long countInstructions(const char *clox, const char *script) {
+    //--stats 실행은 명령어를 세는 run loop를 쓰므로 시간 측정에서는 제외한다
+    FILE *err = tmpfile();
+    if (err == NULL) return -1;
+    double elapsed;
+    long rss;
+    long long count = -1;
+    if (runOnce(clox, script, true, fileno(err), &elapsed, &rss)) {
+        rewind(err);
+        char line[256];
+        while (fgets(line, sizeof(line), err) != NULL) {
+            if (strncmp(line, "instructions=", 13) == 0) count = atoll(line + 13);
+        }
+    }
+    fclose(err);
+    return count;
+}
+
+static int compareDouble(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p) {
+    //nearest-rank
+    int rank = (int) (p * count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+static void loadBaseline(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open baseline \"%s\".\n", path);
+        exit(74);
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL && baselineCount < MAX_BASELINE) {
+        //script,runs,min_ms,median_ms,...
+        char *script = strtok(line, ",");
+        strtok(NULL, ",");
+        strtok(NULL, ",");
+        char *median = strtok(NULL, ",");
+        if (script == NULL || median == NULL || strcmp(script, "script") == 0) continue;
+        BaselineEntry *entry = &baseline[baselineCount++];
+        snprintf(entry->script, sizeof(entry->script), "%s", script);
+        entry->medianMs = atof(median);
+    }
+    fclose(file);
+}
+
+static const BaselineEntry *findBaseline(const char *script) {
+    for (int i = 0; i < baselineCount; i++) {
+        if (strcmp(baseline[i].script, script) == 0) return &baseline[i];
+    }
+    return NULL;
+}
+
+static const char *baseName(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: clox-bench [-n runs] [-o out.csv] [--baseline file.csv] [--threshold percent] <clox> <script>...\n");
+    exit(64);
+}
+
+int main(int argc, const char *argv[]) {
+    int runs = 5;
+    double threshold = 10.0;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            runs = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+            output = fopen(argv[++arg], "w");
+            if (output == NULL) {
+                fprintf(stderr, "Could not open \"%s\".\n", argv[arg]);
+                exit(74);
+            }
+        } else if (strcmp(argv[arg], "--baseline") == 0 && arg + 1 < argc) {
+            loadBaseline(argv[++arg]);
+        } else if (strcmp(argv[arg], "--threshold") == 0 && arg + 1 < argc) {
+            threshold = atof(argv[++arg]);
+        } else {
+            usage();
+        }
+    }
+    if (runs < 1 || argc - arg < 2) usage();
+
+    const char *clox = argv[arg++];
+    double *times = malloc(sizeof(double) * runs);
+    bool regressed = false;
+
+    emit("script,runs,min_ms,median_ms,p95_ms,peak_rss_kb,instructions,baseline_median_ms,change_pct,status\n");
+    for (; arg < argc; arg++) {
+        const char *script = argv[arg];
+        const char *name = baseName(script);
+        long peakRss = 0;
+        bool ok = true;
+
+        for (int i = 0; i < runs && ok; i++) {
+            long rss;
+            ok = runOnce(clox, script, false, -1, &times[i], &rss);
+            if (rss > peakRss) peakRss = rss;
+        }
+        if (!ok) {
+            emit("%s,%d,,,,,,,,fail\n", name, runs);
+            regressed = true;
+            fflush(stdout);
+            continue;
+        }
+
+        qsort(times, runs, sizeof(double), compareDouble);
+        double median = runs % 2 == 1 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+        long long instructions = countInstructions(clox, script);
+
+        emit("%s,%d,%.2f,%.2f,%.2f,%ld,%lld,", name, runs, times[0], median,
+             percentile(times, runs, 0.95), peakRss, instructions);
+
+        const BaselineEntry *base = findBaseline(name);
+        if (base == NULL) {
+            emit(",,%s\n", baselineCount > 0 ? "new" : "ok");
+        } else {
+            double change = (median - base->medianMs) / base->medianMs * 100.0;
+            bool slower = change > threshold;
+            if (slower) regressed = true;
+            emit("%.2f,%+.1f,%s\n", base->medianMs, change, slower ? "regression" : "ok");
+        }
+        fflush(stdout);
+    }
+
+    free(times);
+    if (output != NULL) fclose(output);
+    return regressed ? 1 : 0;
+}
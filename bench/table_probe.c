@@ -0,0 +1,131 @@
+//Table 마이크로벤치마크: 삽입/삭제가 반복되는(churn) 테이블의 probe 길이 분포와 조회 시간을 CSV로 출력한다.
+//usage: clox-table-bench [live keys] [churn rounds]
+//probe 길이는 key를 찾기까지 확인한 버킷 수(home 버킷 = 1)다. 테이블 구현과 무관하게 keys 배열만 보고 계산한다
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "table.h"
+#include "object.h"
+#include "vm.h"
+
+static uint64_t rngState = 0x9E3779B97F4A7C15u;
+
+static uint64_t nextRandom() {
+    //xorshift64: 실행마다 같은 순서로 키를 지우도록 고정 seed를 쓴다
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+static uint32_t hashKey(int n) {
+    //"key<n>"을 VM과 같은 hashString으로 해싱한다
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "key%d", n);
+    return hashString(buffer, length);
+}
+
+static ObjString **makeKeys(int count) {
+    //테이블은 key의 주소와 hash만 보므로 GC 힙 밖의 가짜 ObjString을 쓴다 (GC가 건드리지 않는다).
+    //ObjString은 flexible array member를 가지므로 배열 원소가 될 수 없어 하나씩 할당한다
+    ObjString **keys = malloc(sizeof(ObjString *) * count);
+    for (int i = 0; i < count; i++) {
+        keys[i] = calloc(1, STRING_SIZE(0));
+        keys[i]->obj.type = OBJ_STRING;
+        keys[i]->hash = hashKey(i);
+    }
+    return keys;
+}
+
+static void freeKeys(ObjString **keys, int count) {
+    for (int i = 0; i < count; i++) free(keys[i]);
+    free(keys);
+}
+
+static double nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int probeLength(Table *table, ObjString *key) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t index = key->hash & mask;
+    int length = 1;
+    while (table->keys[index] != key) {
+        index = (index + 1) & mask;
+        length++;
+    }
+    return length;
+}
+
+static void report(const char *phase, Table *table, ObjString **live, int liveCount,
+                   ObjString **missing, int missingCount) {
+    //버킷: 1, 2, 3, 4, 5-8, 9-16, 17+
+    long histogram[7] = {0};
+    long total = 0;
+    int longest = 0;
+    for (int i = 0; i < liveCount; i++) {
+        int length = probeLength(table, live[i]);
+        total += length;
+        if (length > longest) longest = length;
+        int bucket = length <= 4 ? length - 1 : length <= 8 ? 4 : length <= 16 ? 5 : 6;
+        histogram[bucket]++;
+    }
+
+    Value value;
+    double start = nowNs();
+    for (int i = 0; i < liveCount; i++) tableGet(table, live[i], &value);
+    double hitNs = (nowNs() - start) / liveCount;
+    start = nowNs();
+    for (int i = 0; i < missingCount; i++) tableGet(table, missing[i], &value);
+    double missNs = (nowNs() - start) / missingCount;
+
+    printf("%s,%d,%d,%.3f,%d", phase, table->capacity, table->count, (double) total / liveCount, longest);
+    for (int i = 0; i < 7; i++) printf(",%ld", histogram[i]);
+    printf(",%.1f,%.1f\n", hitNs, missNs);
+}
+
+int main(int argc, const char *argv[]) {
+    int liveCount = argc > 1 ? atoi(argv[1]) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 1000000;
+    int missingCount = liveCount;
+
+    initVM();
+    ObjString **keys = makeKeys(liveCount + rounds);
+    ObjString **missing = makeKeys(missingCount);
+    for (int i = 0; i < missingCount; i++) missing[i]->hash = hashKey(-1 - i); //테이블에 넣지 않는 key
+    ObjString **live = malloc(sizeof(ObjString *) * liveCount);
+
+    Table table;
+    initTable(&table);
+    for (int i = 0; i < liveCount; i++) {
+        live[i] = keys[i];
+        tableSet(&table, live[i], NIL_VAL, false);
+    }
+
+    printf("phase,capacity,count,mean_probe,max_probe,p1,p2,p3,p4,p5_8,p9_16,p17_plus,hit_ns,miss_ns\n");
+    report("filled", &table, live, liveCount, missing, missingCount);
+
+    //churn: 임의의 live key 하나를 지우고 새 key 하나를 넣는다. 크기는 그대로지만 삭제 흔적이 쌓인다
+    for (int i = 0; i < rounds; i++) {
+        int victim = (int) (nextRandom() % liveCount);
+        tableDelete(&table, live[victim]);
+        live[victim] = keys[liveCount + i];
+        tableSet(&table, live[victim], NIL_VAL, false);
+    }
+    report("churned", &table, live, liveCount, missing, missingCount);
+
+    //대부분을 지운 뒤: 축소가 일어나는지 확인한다
+    int remaining = liveCount / 16;
+    for (int i = remaining; i < liveCount; i++) tableDelete(&table, live[i]);
+    report("drained", &table, live, remaining, missing, missingCount);
+
+    freeTable(&table);
+    free(live);
+    freeKeys(missing, missingCount);
+    freeKeys(keys, liveCount + rounds);
+    freeVM();
+    return 0;
+}
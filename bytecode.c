@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bytecode.h"
+#include "memory.h"
+#include "vm.h"
+#include "compiler.h"
+
+//파일 구조 (모든 정수는 기록한 기계의 byte order, 가변 길이 영역은 4바이트 경계로 맞춘다):
+//  BytecodeHeader
+//  전역 변수 이름 globalCount개: u32 길이 + 문자
+//  함수 functionCount개 (자식 함수가 먼저, 마지막이 최상위 스크립트):
+//    FunctionHeader, 이름, code, lines(int32 x codeCount), 상수 constantCount개
+//  상수: u32 tag + (숫자: double 8바이트 | 문자열: u32 길이 + 문자 | 함수: 앞에서 나온 함수의 u32 번호)
+//code와 lines는 복사하지 않고 mmap한 페이지를 그대로 chunk로 쓴다. MAP_PRIVATE이므로 quickening이나 전역 슬롯
+//재배치로 바이트를 고쳐 쓰면 그 페이지만 프로세스 전용으로 복사된다.
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t globalCount;
+    uint32_t functionCount;
+} BytecodeHeader;
+
+typedef struct {
+    int32_t nameLength; //-1이면 이름이 없는 최상위 스크립트
+    uint32_t arity;
+    uint32_t upValueCount;
+    uint32_t maxSlots;
+    uint32_t codeCount;
+    uint32_t constantCount;
+} FunctionHeader;
+
+typedef enum {
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION,
+} ConstantTag;
+
+static const char BYTECODE_MAGIC[4] = {'L', 'O', 'X', 'C'};
+
+typedef struct {
+    //mmap한 .loxc 파일
+    void *base;
+    size_t size;
+} BytecodeImage;
+
+//이 VM이 불러온 .loxc들. 함수가 (전역 변수나 스냅샷에) 남아 있는 동안 code를 빌려 쓰므로 freeVM까지 유지한다
+static _Thread_local BytecodeImage *images;
+static _Thread_local int imageCount;
+static _Thread_local int imageCapacity;
+
+uint64_t hashSource(const char *source) {
+    //FNV-1a 64bit
+    uint64_t hash = 14695981039346656037u;
+    for (const char *c = source; *c != '\0'; c++) {
+        hash ^= (uint8_t) *c;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+typedef struct {
+    FILE *file;
+    size_t offset;
+    uint32_t functionCount;
+    bool failed; //상수에 저장할 수 없는 값이 있었다
+} Writer;
+
+static void writeBytes(Writer *writer, const void *bytes, size_t size) {
+    fwrite(bytes, 1, size, writer->file);
+    writer->offset += size;
+}
+
+static void writeU32(Writer *writer, uint32_t value) {
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writePadding(Writer *writer) {
+    static const uint8_t zeros[3] = {0};
+    if (writer->offset % 4 != 0) writeBytes(writer, zeros, 4 - writer->offset % 4);
+}
+
+static void writeText(Writer *writer, const char *chars, int length) {
+    writeU32(writer, (uint32_t) length);
+    writeBytes(writer, chars, length);
+    writePadding(writer);
+}
+
+static uint32_t writeFunction(Writer *writer, ObjFunction *function) {
+    //자식 함수를 먼저 기록해서, 불러올 때 상수가 가리키는 함수가 항상 이미 만들어져 있게 한다
+    Chunk *chunk = &function->chunk;
+    if (function->lazy != NULL) writer->failed = true; //컴파일하지 않은 본문은 저장할 수 없다
+    uint32_t *children = malloc(sizeof(uint32_t) * (chunk->constants.count + 1));
+    for (int i = 0; i < chunk->constants.count; i++) {
+        if (IS_FUNCTION(chunk->constants.values[i])) {
+            children[i] = writeFunction(writer, AS_FUNCTION(chunk->constants.values[i]));
+        }
+    }
+
+    FunctionHeader header = {
+        .nameLength = function->name != NULL ? function->name->length : -1,
+        .arity = (uint32_t) function->arity,
+        .upValueCount = (uint32_t) function->upValueCount,
+        .maxSlots = (uint32_t) function->maxSlots,
+        .codeCount = (uint32_t) chunk->count,
+        .constantCount = (uint32_t) chunk->constants.count,
+    };
+    writeBytes(writer, &header, sizeof(header));
+    if (function->name != NULL) writeBytes(writer, function->name->chars, function->name->length);
+    writePadding(writer);
+    writeBytes(writer, chunk->code, chunk->count);
+    writePadding(writer);
+    for (int i = 0; i < chunk->count; i++) {
+        int32_t line = chunk->lines[i];
+        writeBytes(writer, &line, sizeof(line));
+    }
+
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value value = chunk->constants.values[i];
+        if (IS_NUMBER(value)) {
+            double number = AS_NUMBER(value);
+            writeU32(writer, CONSTANT_NUMBER);
+            writeBytes(writer, &number, sizeof(number));
+        } else if (IS_STRING(value)) {
+            writeU32(writer, CONSTANT_STRING);
+            writeText(writer, AS_STRING(value)->chars, AS_STRING(value)->length);
+        } else if (IS_FUNCTION(value)) {
+            writeU32(writer, CONSTANT_FUNCTION);
+            writeU32(writer, children[i]);
+        } else {
+            writer->failed = true;
+        }
+    }
+    free(children);
+    return writer->functionCount++;
+}
+
+bool writeBytecode(ObjFunction *script, uint64_t sourceHash, const char *path) {
+    //임시 파일에 다 쓴 뒤 rename한다. 다른 프로세스가 mmap해서 실행 중인 이전 파일은 그대로 남는다
+    size_t pathLength = strlen(path);
+    char *tempPath = malloc(pathLength + 5);
+    memcpy(tempPath, path, pathLength);
+    memcpy(tempPath + pathLength, ".tmp", 5);
+
+    Writer writer = {.file = fopen(tempPath, "wb")};
+    if (writer.file == NULL) {
+        free(tempPath);
+        return false;
+    }
+
+    BytecodeHeader header = {
+        .version = BYTECODE_VERSION,
+        .sourceHash = sourceHash,
+        .globalCount = (uint32_t) vm.globals.vars.count,
+    };
+    memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+    writeBytes(&writer, &header, sizeof(header));
+
+    //전역 슬롯 번호는 이 VM에서 매긴 것이므로 이름을 같이 남겨서 불러올 때 다시 매핑한다
+    for (int i = 0; i < vm.globals.vars.count; i++) {
+        ObjString *name = READ_AS(GlobalVar, &vm.globals.vars, i).name;
+        writeText(&writer, name->chars, name->length);
+    }
+    writeFunction(&writer, script);
+
+    header.functionCount = writer.functionCount;
+    fseek(writer.file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, writer.file);
+
+    bool ok = !writer.failed && !ferror(writer.file);
+    ok = fclose(writer.file) == 0 && ok;
+    ok = ok && rename(tempPath, path) == 0;
+    if (!ok) remove(tempPath);
+    free(tempPath);
+    return ok;
+}
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t offset;
+    uint16_t *globals; //파일의 전역 슬롯 -> 이 VM의 전역 슬롯
+    uint32_t globalCount;
+    bool remapGlobals; //슬롯 번호가 하나라도 다르면 code의 전역 operand를 고쳐 쓴다
+    const char *error;
+} Reader;
+
+static bool fail(Reader *reader, const char *error) {
+    if (reader->error == NULL) reader->error = error;
+    return false;
+}
+
+static void *take(Reader *reader, size_t size) {
+    //파일 안의 다음 size 바이트를 가리키는 포인터. 파일 끝을 넘으면 NULL
+    if (size > reader->size - reader->offset) {
+        fail(reader, "Truncated bytecode file.");
+        return NULL;
+    }
+    void *bytes = reader->base + reader->offset;
+    reader->offset += size;
+    return bytes;
+}
+
+static bool readBytes(Reader *reader, void *dest, size_t size) {
+    void *bytes = take(reader, size);
+    if (bytes == NULL) return false;
+    memcpy(dest, bytes, size);
+    return true;
+}
+
+static bool readU32(Reader *reader, uint32_t *value) {
+    return readBytes(reader, value, sizeof(*value));
+}
+
+static void skipPadding(Reader *reader) {
+    reader->offset = (reader->offset + 3) & ~(size_t) 3;
+    if (reader->offset > reader->size) reader->offset = reader->size;
+}
+
+static ObjString *readText(Reader *reader) {
+    uint32_t length;
+    if (!readU32(reader, &length) || length > INT_MAX) return NULL;
+    const char *chars = take(reader, length);
+    if (chars == NULL) return NULL;
+    skipPadding(reader);
+    return copyString(chars, (int) length);
+}
+
+static uint16_t readShort(uint8_t *code) {
+    return (uint16_t) (code[0] << 8 | code[1]);
+}
+
+static uint32_t readWord(uint8_t *code) {
+    return (uint32_t) code[0] << 24 | (uint32_t) code[1] << 16 | (uint32_t) code[2] << 8 | code[3];
+}
+
+typedef struct {
+    //verifyFunction이 명령어 하나를 해석한 결과
+    int length;
+    int jump; //점프 명령어의 대상 offset, 아니면 -1
+} Decoded;
+
+static bool verifyClosure(Reader *reader, ObjFunction *function, int offset, uint8_t *operands, int constant,
+                          bool wide, Decoded *decoded) {
+    Chunk *chunk = &function->chunk;
+    if (constant >= chunk->constants.count || !IS_FUNCTION(chunk->constants.values[constant])) {
+        return fail(reader, "Closure operand is not a function.");
+    }
+    int width = wide ? 2 : 1;
+    ObjFunction *closure = AS_FUNCTION(chunk->constants.values[constant]);
+    int length = decoded->length + closure->upValueCount * (1 + width);
+    if (offset + length > chunk->count) {
+        return fail(reader, "Truncated closure instruction.");
+    }
+    uint8_t *pair = operands + width;
+    for (int i = 0; i < closure->upValueCount; i++, pair += 1 + width) {
+        int index = wide ? readShort(pair + 1) : pair[1];
+        if (pair[0] > 1) return fail(reader, "Invalid upvalue capture.");
+        if (pair[0] == 1 ? index >= function->maxSlots : index >= function->upValueCount) {
+            return fail(reader, "Upvalue capture out of range.");
+        }
+    }
+    decoded->length = length;
+    return true;
+}
+
+static bool verifyGlobal(Reader *reader, uint8_t *operand) {
+    uint16_t slot = readShort(operand);
+    if (slot >= reader->globalCount) return fail(reader, "Global slot out of range.");
+    if (reader->remapGlobals) {
+        uint16_t mapped = reader->globals[slot];
+        operand[0] = (uint8_t) (mapped >> 8);
+        operand[1] = (uint8_t) (mapped & 0xff);
+    }
+    return true;
+}
+
+static bool decodeInstruction(Reader *reader, ObjFunction *function, int offset, Decoded *decoded) {
+    //명령어 하나의 길이를 구하고 피연산자가 범위 안에 있는지 확인한다. 전역 슬롯은 이 VM의 번호로 고쳐 쓴다
+    Chunk *chunk = &function->chunk;
+    uint8_t *code = chunk->code + offset;
+    int remaining = chunk->count - offset;
+    int constants = chunk->constants.count;
+    bool wide = code[0] == OP_WIDE;
+    if (wide && remaining < 2) return fail(reader, "Truncated wide instruction.");
+    uint8_t instruction = wide ? code[1] : code[0];
+    uint8_t *operands = code + (wide ? 2 : 1);
+    int width = wide ? 2 : 1; //1바이트 피연산자의 실제 너비
+    int jumpWidth = wide ? 4 : 2;
+    int sign = 1;
+
+    decoded->jump = -1;
+    switch (instruction) {
+        case OP_NIL: case OP_TRUE: case OP_FALSE: case OP_POP: case OP_EQUAL_PRESERVE:
+        case OP_EQUAL: case OP_GREATER: case OP_LESS: case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY:
+        case OP_DIVIDE: case OP_MODULO: case OP_NOT: case OP_NEGATIVE: case OP_PRINT: case OP_PRINTLN:
+        case OP_CLOSE_UPVALUE: case OP_RETURN:
+        case OP_ADD_NUM: case OP_ADD_STR: case OP_SUBTRACT_NUM: case OP_MULTIPLY_NUM: case OP_DIVIDE_NUM:
+        case OP_GREATER_NUM: case OP_LESS_NUM:
+            if (wide) return fail(reader, "Invalid wide instruction.");
+            decoded->length = 1;
+            return true;
+        case OP_SMALL_INT:
+        case OP_BUILD_STRING:
+            if (wide) return fail(reader, "Invalid wide instruction.");
+            decoded->length = 2;
+            return remaining >= 2 || fail(reader, "Truncated instruction.");
+        case OP_CONSTANT:
+            if (wide) return fail(reader, "Invalid wide instruction.");
+            if (remaining < 2) return fail(reader, "Truncated instruction.");
+            decoded->length = 2;
+            return operands[0] < constants || fail(reader, "Constant out of range.");
+        case OP_CONSTANT_LONG:
+            if (wide) return fail(reader, "Invalid wide instruction.");
+            if (remaining < 4) return fail(reader, "Truncated instruction.");
+            decoded->length = 4;
+            return (operands[0] << 16 | operands[1] << 8 | operands[2]) < constants ||
+                   fail(reader, "Constant out of range.");
+        case OP_GET_GLOBAL: case OP_SET_GLOBAL: case OP_DEFINE_CONST_GLOBAL: case OP_DEFINE_LET_GLOBAL:
+            if (wide) return fail(reader, "Invalid wide instruction.");
+            if (remaining < 3) return fail(reader, "Truncated instruction.");
+            decoded->length = 3;
+            return verifyGlobal(reader, operands);
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CALL: {
+            decoded->length = (int) (operands - code) + width;
+            if (remaining < decoded->length) return fail(reader, "Truncated instruction.");
+            int operand = wide ? readShort(operands) : operands[0];
+            if ((instruction == OP_GET_LOCAL || instruction == OP_SET_LOCAL) && operand >= function->maxSlots) {
+                return fail(reader, "Local slot out of range.");
+            }
+            if ((instruction == OP_GET_UPVALUE || instruction == OP_SET_UPVALUE) &&
+                operand >= function->upValueCount) {
+                return fail(reader, "Upvalue out of range.");
+            }
+            return true;
+        }
+        case OP_CLOSURE: {
+            decoded->length = (int) (operands - code) + width;
+            if (remaining < decoded->length) return fail(reader, "Truncated instruction.");
+            return verifyClosure(reader, function, offset, operands, wide ? readShort(operands) : operands[0],
+                                 wide, decoded);
+        }
+        case OP_ADD_LOCALS:
+        case OP_SUBTRACT_LOCALS:
+        case OP_MULTIPLY_LOCALS:
+        case OP_ADD_LOCAL_CONSTANT:
+            if (wide) return fail(reader, "Invalid wide instruction.");
+            if (remaining < 3) return fail(reader, "Truncated instruction.");
+            decoded->length = 3;
+            if (operands[0] >= function->maxSlots) return fail(reader, "Local slot out of range.");
+            if (instruction == OP_ADD_LOCAL_CONSTANT) {
+                return operands[1] < constants || fail(reader, "Constant out of range.");
+            }
+            return operands[1] < function->maxSlots || fail(reader, "Local slot out of range.");
+        case OP_LOOP:
+            sign = -1;
+            //fallthrough
+        case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_POP_JUMP_IF_FALSE: case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_NOT_GREATER: case OP_JUMP_IF_NOT_LESS: case OP_JUMP_IF_GREATER: case OP_JUMP_IF_LESS: {
+            decoded->length = (int) (operands - code) + jumpWidth;
+            if (remaining < decoded->length) return fail(reader, "Truncated instruction.");
+            int64_t distance = wide ? readWord(operands) : readShort(operands);
+            int64_t target = offset + decoded->length + sign * distance;
+            if (target < 0 || target >= chunk->count) return fail(reader, "Jump target out of range.");
+            decoded->jump = (int) target;
+            return true;
+        }
+        default:
+            return fail(reader, "Unknown opcode.");
+    }
+}
+
+static bool verifyFunction(Reader *reader, ObjFunction *function) {
+    //모든 명령어의 피연산자가 범위 안에 있고, 점프는 명령어의 시작으로만 가며, 마지막 명령어가 OP_RETURN인지 확인한다.
+    //손상되거나 잘린 파일을 걸러내기 위한 검사다. 구조가 맞으면 스택 깊이가 maxSlots 안에 드는지도 본다 (fiber 스택 크기가 maxSlots로 정해진다)
+    Chunk *chunk = &function->chunk;
+    if (chunk->count == 0) return fail(reader, "Empty function.");
+    uint8_t *starts = calloc(chunk->count, 1);
+    int *jumps = malloc(sizeof(int) * chunk->count);
+    int jumpCount = 0;
+    int last = 0;
+    bool ok = true;
+    for (int offset = 0; ok && offset < chunk->count;) {
+        Decoded decoded;
+        ok = decodeInstruction(reader, function, offset, &decoded);
+        starts[offset] = 1;
+        last = offset;
+        if (decoded.jump != -1) jumps[jumpCount++] = decoded.jump;
+        offset += decoded.length;
+    }
+    for (int i = 0; ok && i < jumpCount; i++) {
+        if (!starts[jumps[i]]) ok = fail(reader, "Jump into the middle of an instruction.");
+    }
+    if (ok && chunk->code[last] != OP_RETURN) ok = fail(reader, "Function does not end with a return.");
+    if (ok) {
+        int depth = stackDepth(function);
+        if (depth < 0 || depth > function->maxSlots) ok = fail(reader, "Inconsistent stack depth.");
+    }
+    free(starts);
+    free(jumps);
+    return ok;
+}
+
+bool verifyBytecode(ObjFunction *function, int globalCount, const char **error) {
+    Reader reader = {.globalCount = (uint32_t) globalCount};
+    if (verifyFunction(&reader, function)) return true;
+    *error = reader.error;
+    return false;
+}
+
+static ObjFunction *readFunction(Reader *reader, ObjFunction *holder) {
+    //holder: 불러온 함수를 모두 상수로 들고 있는 임시 함수 (스택에 올려서 GC root로 쓴다). i번 함수는 holder의 i번 상수
+    FunctionHeader header;
+    if (!readBytes(reader, &header, sizeof(header))) return NULL;
+    if (header.nameLength < -1 || header.codeCount > INT_MAX / sizeof(int32_t) ||
+        header.arity > UINT16_MAX || header.upValueCount > UINT16_COUNT || header.maxSlots > INT_MAX) {
+        fail(reader, "Invalid function header.");
+        return NULL;
+    }
+
+    ObjFunction *function = newFunction();
+    addConstant(&holder->chunk, OBJ_VAL(function));
+    function->arity = (int) header.arity;
+    function->upValueCount = (int) header.upValueCount;
+    function->maxSlots = (int) header.maxSlots;
+    if (header.nameLength >= 0) {
+        const char *name = take(reader, header.nameLength);
+        if (name == NULL) return NULL;
+        function->name = copyString(name, header.nameLength);
+    }
+    skipPadding(reader);
+
+    Chunk *chunk = &function->chunk;
+    chunk->code = take(reader, header.codeCount);
+    skipPadding(reader);
+    chunk->lines = take(reader, header.codeCount * sizeof(int32_t));
+    if (chunk->code == NULL || chunk->lines == NULL) return NULL;
+    chunk->count = (int) header.codeCount;
+    chunk->ownsCode = false;
+
+    for (uint32_t i = 0; i < header.constantCount; i++) {
+        uint32_t tag;
+        if (!readU32(reader, &tag)) return NULL;
+        switch (tag) {
+            case CONSTANT_NUMBER: {
+                double number;
+                if (!readBytes(reader, &number, sizeof(number))) return NULL;
+                addConstant(chunk, NUMBER_VAL(number));
+                break;
+            }
+            case CONSTANT_STRING: {
+                ObjString *string = readText(reader);
+                if (string == NULL) return NULL;
+                addConstant(chunk, OBJ_VAL(string));
+                break;
+            }
+            case CONSTANT_FUNCTION: {
+                uint32_t index;
+                if (!readU32(reader, &index)) return NULL;
+                if (index >= (uint32_t) holder->chunk.constants.count - 1) {
+                    fail(reader, "Function constant out of order.");
+                    return NULL;
+                }
+                addConstant(chunk, holder->chunk.constants.values[index]);
+                break;
+            }
+            default:
+                fail(reader, "Unknown constant tag.");
+                return NULL;
+        }
+    }
+    return verifyFunction(reader, function) ? function : NULL;
+}
+
+static ObjFunction *readImage(Reader *reader, bool checkSource, uint64_t sourceHash) {
+    BytecodeHeader header;
+    if (!readBytes(reader, &header, sizeof(header))) return NULL;
+    if (memcmp(header.magic, BYTECODE_MAGIC, sizeof(header.magic)) != 0) {
+        fail(reader, "Not a bytecode file.");
+        return NULL;
+    }
+    if (header.version != BYTECODE_VERSION) {
+        fail(reader, "Bytecode version mismatch.");
+        return NULL;
+    }
+    if (checkSource && header.sourceHash != sourceHash) {
+        fail(reader, "Bytecode is out of date.");
+        return NULL;
+    }
+    if (header.functionCount == 0 || header.globalCount > UINT16_COUNT) {
+        fail(reader, "Invalid bytecode header.");
+        return NULL;
+    }
+
+    reader->globalCount = header.globalCount;
+    reader->globals = malloc(sizeof(uint16_t) * (header.globalCount + 1));
+    for (uint32_t i = 0; i < header.globalCount; i++) {
+        ObjString *name = readText(reader);
+        if (name == NULL) return NULL;
+        int slot = globalSlot(name);
+        if (slot > UINT16_MAX) {
+            fail(reader, "Too many global variables.");
+            return NULL;
+        }
+        reader->globals[i] = (uint16_t) slot;
+        if (slot != (int) i) reader->remapGlobals = true;
+    }
+
+    ObjFunction *holder = newFunction();
+    push(OBJ_VAL(holder));
+    ObjFunction *function = NULL;
+    for (uint32_t i = 0; i < header.functionCount; i++) {
+        function = readFunction(reader, holder);
+        if (function == NULL) break;
+    }
+    pop();
+    if (function != NULL && reader->offset != reader->size) {
+        fail(reader, "Trailing data in bytecode file.");
+        return NULL;
+    }
+    return function;
+}
+
+ObjFunction *loadBytecode(const char *path, bool checkSource, uint64_t sourceHash, const char **error) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *error = "Could not open bytecode file.";
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        *error = "Could not read bytecode file.";
+        return NULL;
+    }
+    //MAP_PRIVATE: 고쳐 쓴 페이지는 이 프로세스에만 보이고 파일에는 반영되지 않는다
+    void *base = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        *error = "Could not map bytecode file.";
+        return NULL;
+    }
+
+    Reader reader = {.base = base, .size = (size_t) info.st_size};
+    ObjFunction *function = readImage(&reader, checkSource, sourceHash);
+    free(reader.globals);
+    if (function == NULL) {
+        //이미 만든 함수들은 어디에서도 참조되지 않으므로 mmap을 해제해도 된다 (freeChunk는 빌려 쓴 code를 건드리지 않는다)
+        *error = reader.error != NULL ? reader.error : "Invalid bytecode file.";
+        munmap(base, reader.size);
+        return NULL;
+    }
+    if (imageCount == imageCapacity) {
+        imageCapacity = imageCapacity < 4 ? 4 : imageCapacity * 2;
+        images = (BytecodeImage *) realloc(images, sizeof(BytecodeImage) * imageCapacity);
+        if (images == NULL) exit(1);
+    }
+    images[imageCount++] = (BytecodeImage) {.base = base, .size = reader.size};
+    return function;
+}
+
+void closeBytecode() {
+    for (int i = 0; i < imageCount; i++) {
+        munmap(images[i].base, images[i].size);
+    }
+    free(images);
+    images = NULL;
+    imageCount = 0;
+    imageCapacity = 0;
+}
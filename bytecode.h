@@ -0,0 +1,25 @@
+#ifndef CLOX_BYTECODE_H
+#define CLOX_BYTECODE_H
+
+#include "common.h"
+#include "object.h"
+
+//.loxc: 컴파일된 함수 트리를 그대로 저장한 파일. 명령어 집합이나 형식이 바뀌면 올린다
+#define BYTECODE_VERSION 2
+
+//소스 텍스트의 해시. .loxc가 어떤 소스에서 컴파일되었는지 확인하는 데 쓴다 (vm.hashSeed와 무관하게 항상 같은 값)
+uint64_t hashSource(const char *source);
+
+bool writeBytecode(ObjFunction *script, uint64_t sourceHash, const char *path);
+
+//checkSource면 파일에 기록된 소스 해시가 sourceHash와 같아야 한다. 실패하면 NULL을 반환하고 *error에 이유를 남긴다.
+//불러온 함수들의 code/lines는 mmap한 파일을 가리키므로 파일은 closeBytecode(freeVM)까지 매핑된 채로 남는다
+ObjFunction *loadBytecode(const char *path, bool checkSource, uint64_t sourceHash, const char **error);
+
+//이 VM이 불러온 .loxc를 모두 unmap한다. heap 객체가 모두 해제된 뒤 freeVM에서 부른다
+void closeBytecode();
+
+//loadBytecode와 같은 검사를 다른 경로로 불러온 함수(스냅샷)에 한다. 상수의 함수 객체들이 이미 만들어져 있어야 한다
+bool verifyBytecode(ObjFunction *function, int globalCount, const char **error);
+
+#endif //CLOX_BYTECODE_H
@@ -7,6 +7,7 @@
 typedef enum {
     OP_CONSTANT,
     OP_CONSTANT_LONG,
+    OP_SMALL_INT, //operand: 0~255 정수 (상수 배열을 거치지 않는다)
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
@@ -30,7 +31,7 @@ typedef enum {
     OP_MODULO,
     OP_NOT,
     OP_NEGATIVE,
-    OP_TOSTRING,
+    OP_BUILD_STRING, //operand n: 스택의 값 n개를 문자열로 바꿔 하나로 이어 붙인다 (문자열 보간)
     OP_PRINT,
     OP_PRINTLN,
     OP_JUMP,
@@ -40,6 +41,29 @@ typedef enum {
     OP_CLOSURE,
     OP_CLOSE_UPVALUE,
     OP_RETURN,
+    //다음 명령어의 피연산자를 두 배 너비로 읽게 하는 접두사 (1바이트 -> 2바이트, 점프 offset 2바이트 -> 4바이트).
+    //지역 변수/upvalue/인자 개수가 256을 넘거나 점프가 64KB를 넘는 큰 (생성된) 스크립트에서만 나온다
+    OP_WIDE,
+    //superinstruction: 컴파일러의 peephole 단계가 자주 붙어 나오는 명령어 조합을 하나로 합쳐서 내보낸다
+    OP_POP_JUMP_IF_FALSE, //조건을 pop하고 거짓이면 점프
+    OP_JUMP_IF_NOT_EQUAL, //두 값을 pop하고 비교한 결과로 점프
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_NOT_LESS,
+    OP_JUMP_IF_GREATER, // a <= b
+    OP_JUMP_IF_LESS, // a >= b
+    OP_ADD_LOCALS, //지역 변수 슬롯 두 개를 피연산자로 받는다
+    OP_SUBTRACT_LOCALS,
+    OP_MULTIPLY_LOCALS,
+    OP_ADD_LOCAL_CONSTANT, // x = x + 상수
+    //quickening: run()이 피연산자 타입을 관찰한 뒤 제네릭 명령어를 제자리에서 아래의 특수화된 명령어로 바꿔 쓴다.
+    //컴파일러는 이 명령어들을 직접 내보내지 않는다
+    OP_ADD_NUM,
+    OP_ADD_STR,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_GREATER_NUM,
+    OP_LESS_NUM,
 } OpCode;
 
 typedef struct {
@@ -48,6 +72,7 @@ typedef struct {
     uint8_t *code;
     int *lines;
     ValueArray constants;
+    bool ownsCode; //false면 code와 lines는 mmap한 .loxc 파일을 빌려 쓰는 것이다 (해제하거나 늘리지 않는다)
 } Chunk;
 
 void initChunk(Chunk *chunk);
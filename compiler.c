@@ -5,13 +5,8 @@
 #include "scanner.h"
 #include "common.h"
 #include "memory.h"
-
-#ifdef DEBUG_PRINT_CODE
-
 #include "debug.h"
 
-#endif
-
 typedef struct {
     Token current;
     Token previous;
@@ -51,7 +46,7 @@ typedef struct {
 } Local;
 
 typedef struct {
-    uint8_t index;
+    uint16_t index;
     bool isLocal;
 } UpValue;
 
@@ -60,30 +55,61 @@ typedef enum {
     TYPE_SCRIPT,
 } FunctionType;
 
+typedef struct {
+    //상수 값 -> 상수 배열 인덱스 (open addressing, 선형 탐사). 같은 리터럴을 여러 번 써도 상수 배열에는 한 번만 들어간다
+    int count;
+    int capacity; //항상 2의 거듭제곱
+    Value *keys;
+    int *indexes;
+} ConstantMap;
+
+typedef struct LazyFunction {
+    //--lazy: 아직 컴파일하지 않은 함수 본문. 처음 훑을 때의 위치와, 본문이 참조하는 바깥 변수(upvalue)의 이름을 기억한다
+    ObjString *source; //본문이 들어 있는 소스 (compile()이 복사해둔 것이므로 실행 중에도 유효하다)
+    Scanner scanner; //'(' 다음 위치
+    Token name; //함수 이름 토큰
+    Token paren; //'(' 토큰
+    int upValueCount;
+    int capacity;
+    Token *names; //upvalue i의 이름
+    UpValue *upValues; //upvalue i를 어디서 캡처하는지 (OP_CLOSURE를 내보낸 뒤에는 필요 없으므로 해제한다)
+} LazyFunction;
+
 typedef struct Compiler {
     struct Compiler *enclosing;
     ObjFunction *function;
     FunctionType type;
-    Local locals[UINT8_COUNT];
+    Local *locals; //필요할 때 늘린다 (최대 UINT16_COUNT개, 256개를 넘는 슬롯은 OP_WIDE로 접근)
     int localCount; //스코프에 있는 지역 변수의 개수(사용중인 배열 슬롯의 개수) 추적
-    UpValue upValues[UINT8_COUNT];
+    int localCapacity;
+    UpValue *upValues;
+    int upValueCapacity;
     int scopeDepth; //'컴파일중인' 현재 코드의 비트를 둘러싼 블록의 개수
     int unpatchedBreaks;
+    int recentOps[3]; //peephole: 최근에 내보낸 명령어들의 시작 offset (오래된 것 -> 최근 것), -1은 없음
+    ConstantMap constants; //이 함수의 chunk에 이미 넣은 리터럴 상수
+    bool wideJumps; //모든 전방 점프를 OP_WIDE + 4바이트 offset으로 내보낸다 (재컴파일할 때만 켠다)
+    bool jumpOverflow; //16비트 offset에 들어가지 않는 전방 점프가 있었다 -> 함수를 wideJumps로 다시 컴파일
+    LazyFunction *lazy; //실행 중에 컴파일하는 함수: 바깥 Compiler가 없으므로 upvalue는 lazy의 이름으로 찾는다
 } Compiler;
 
 typedef struct Loop {
     struct Loop *enclosing;
+    Compiler *compiler; //루프가 있는 함수. 루프 안에 선언한 함수의 본문은 이 루프에 속하지 않는다
     int continueOffset;
     int unpatchedBreakJumps;
+    int scopeDepth; //루프 본문 바깥의 스코프 깊이. break/continue는 이보다 깊은 지역 변수를 정리하고 점프한다
 } Loop;
 
 
-Parser parser;
-Compiler *current = NULL; //원칙적으로라면 Compiler 포인터를 받는 매개변수를 프론트엔드에 있는 각 매게 변수에 전달하겠지만....
-Chunk *compilingChunk;
+//컴파일러 상태도 스레드 로컬이다: isolate마다 따로 컴파일하므로 여러 스레드가 동시에 compile()을 호출할 수 있다
+_Thread_local Parser parser;
+_Thread_local Compiler *current = NULL; //원칙적으로라면 Compiler 포인터를 받는 매개변수를 프론트엔드에 있는 각 매게 변수에 전달하겠지만....
+_Thread_local Chunk *compilingChunk;
 
-Loop *currentLoop = NULL;
-Array unpatchedBreaks;
+_Thread_local Loop *currentLoop = NULL;
+_Thread_local Array unpatchedBreaks;
+_Thread_local ObjString *lazySource = NULL; //--lazy에서 컴파일 중인 소스의 복사본. 함수 stub들이 나중에 이 안의 토큰을 다시 읽는다
 
 static Chunk *currentChunk() {
     //현재 chunk는 항상 컴파일 중인 함수가 소유한 chunk
@@ -93,16 +119,16 @@ static Chunk *currentChunk() {
 static void errorAt(Token *token, const char *message) {
     if (parser.panicMode) return; // panic mode flag가 세팅되면 다른 에러가 나도 그냥 무시
     parser.panicMode = true;
-    fprintf(stderr, "[line %d] Error", token->line); //error가 발생한 줄 번호 출력
+    fprintf(vm.err, "[line %d] Error", token->line); //error가 발생한 줄 번호 출력
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, "at end");
+        fprintf(vm.err, "at end");
     } else if (token->type == TOKEN_ERROR) {
         //none
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(vm.err, " at '%.*s'", token->length, token->start);
     }
-    fprintf(stderr, ": %s\n", message);
+    fprintf(vm.err, ": %s\n", message);
     parser.hadError = true;
 }
 
@@ -147,14 +173,138 @@ static void emitByte(uint8_t byte) {
     writeChunk(currentChunk(), byte, parser.previous.line);
 }
 
+static void resetPeephole() {
+    //점프 대상(레이블)이 되는 위치에서는 기록을 비워서 레이블을 가로질러 명령어를 합치는 일이 없도록 한다
+    current->recentOps[0] = current->recentOps[1] = current->recentOps[2] = -1;
+}
+
+static void emitOp(uint8_t op) {
+    //명령어의 첫 바이트(opcode)는 항상 이 함수로 내보내서 peephole 단계가 명령어 경계를 알 수 있게 한다
+    current->recentOps[0] = current->recentOps[1];
+    current->recentOps[1] = current->recentOps[2];
+    current->recentOps[2] = currentChunk()->count;
+    emitByte(op);
+}
+
+static void rewindTo(int offset) {
+    //offset 이후에 내보낸 명령어들을 버린다. 합친 명령어를 그 자리에 다시 쓰기 위해 사용
+    currentChunk()->count = offset;
+    resetPeephole();
+}
+
 static void emitBytes(uint8_t byte1, uint8_t byte2) {
-    emitByte(byte1);
+    emitOp(byte1);
     emitByte(byte2);
 }
 
+static void emitShort(uint8_t instruction, uint16_t operand) {
+    //16bit 피연산자는 big-endian으로 기록 (READ_SHORT와 대응)
+    emitOp(instruction);
+    emitByte((operand >> 8) & 0xff);
+    emitByte(operand & 0xff);
+}
+
+static void emitOperand(uint8_t instruction, int operand) {
+    //1바이트 피연산자를 받는 명령어. 256 이상이면 OP_WIDE 접두사를 붙이고 2바이트로 기록한다
+    if (operand <= UINT8_MAX) {
+        emitBytes(instruction, (uint8_t) operand);
+        return;
+    }
+    emitOp(OP_WIDE);
+    emitByte(instruction);
+    emitByte((operand >> 8) & 0xff);
+    emitByte(operand & 0xff);
+}
+
+static void emitWord(uint32_t word) {
+    //OP_WIDE 점프의 4바이트 offset (big-endian)
+    emitByte((word >> 24) & 0xff);
+    emitByte((word >> 16) & 0xff);
+    emitByte((word >> 8) & 0xff);
+    emitByte(word & 0xff);
+}
+
 static void emitReturn() {
-    emitByte(OP_NIL);
-    emitByte(OP_RETURN);
+    emitOp(OP_NIL);
+    emitOp(OP_RETURN);
+}
+
+static uint32_t hashConstant(Value value) {
+    //숫자는 비트 패턴, 문자열은 (인터닝된) 객체 주소로 해싱한다
+    uint64_t bits;
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        memcpy(&bits, &number, sizeof(bits));
+    } else {
+        bits = (uint64_t) (uintptr_t) AS_OBJ(value);
+    }
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdu;
+    bits ^= bits >> 33;
+    return (uint32_t) bits;
+}
+
+static bool sameConstant(Value a, Value b) {
+    //숫자는 비트 패턴으로 비교한다: valuesEqual과 달리 0과 -0을 구분해야 같은 상수로 합칠 수 있다
+    if (IS_NUMBER(a) != IS_NUMBER(b)) return false;
+    if (IS_NUMBER(a)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    return AS_OBJ(a) == AS_OBJ(b);
+}
+
+static int findConstantSlot(ConstantMap *map, Value value) {
+    uint32_t mask = map->capacity - 1;
+    uint32_t index = hashConstant(value) & mask;
+    while (map->indexes[index] != -1 && !sameConstant(map->keys[index], value)) {
+        index = (index + 1) & mask;
+    }
+    return (int) index;
+}
+
+static void growConstantMap(ConstantMap *map) {
+    ConstantMap resized = {.count = map->count, .capacity = GROW_CAPACITY(map->capacity)};
+    resized.keys = ALLOCATE(Value, resized.capacity);
+    resized.indexes = ALLOCATE(int, resized.capacity);
+    for (int i = 0; i < resized.capacity; i++) resized.indexes[i] = -1;
+    for (int i = 0; i < map->capacity; i++) {
+        if (map->indexes[i] == -1) continue;
+        int slot = findConstantSlot(&resized, map->keys[i]);
+        resized.keys[slot] = map->keys[i];
+        resized.indexes[slot] = map->indexes[i];
+    }
+    FREE_ARRAY(Value, map->keys, map->capacity);
+    FREE_ARRAY(int, map->indexes, map->capacity);
+    *map = resized;
+}
+
+static void freeConstantMap(ConstantMap *map) {
+    FREE_ARRAY(Value, map->keys, map->capacity);
+    FREE_ARRAY(int, map->indexes, map->capacity);
+    map->count = 0;
+    map->capacity = 0;
+    map->keys = NULL;
+    map->indexes = NULL;
+}
+
+static int literalConstant(Value value) {
+    //리터럴(숫자, 문자열)을 상수 배열에 넣고 인덱스를 반환한다. 이미 넣은 값이면 기존 인덱스를 재사용한다.
+    //key로 쓰는 값은 상수 배열에도 들어 있으므로 (컴파일 중인 함수를 통해) GC로부터 보호된다
+    ConstantMap *map = &current->constants;
+    if (map->capacity > 0) {
+        int slot = findConstantSlot(map, value);
+        if (map->indexes[slot] != -1) return map->indexes[slot];
+    }
+
+    int constant = addConstant(currentChunk(), value);
+    if (map->count + 1 > map->capacity / 2) growConstantMap(map); //부하율 50% 이하 유지
+    int slot = findConstantSlot(map, value);
+    map->keys[slot] = value;
+    map->indexes[slot] = constant;
+    map->count++;
+    return constant;
 }
 
 static int makeConstant(Value value) {
@@ -164,15 +314,15 @@ static int makeConstant(Value value) {
         error("Too many constants in one chunk.");
         return 0;
     }
-    return (uint8_t) constant;
+    return constant;
 }
 
 static void emitConstant(Value value) {
-    int constant = addConstant(currentChunk(), value);
+    int constant = literalConstant(value);
     if (constant <= UINT8_MAX) {
         emitBytes(OP_CONSTANT, (uint8_t) constant);
     } else if (constant < (1 << 24)) {
-        emitByte(OP_CONSTANT_LONG);
+        emitOp(OP_CONSTANT_LONG);
         emitByte((constant >> 16) & 0xFF);
         emitByte((constant >> 8) & 0xFF);
         emitByte(constant & 0xFF);
@@ -182,31 +332,130 @@ static void emitConstant(Value value) {
 }
 
 static void emitLoop(int loopStart) {
+    //뒤로 가는 점프는 거리를 이미 알고 있으므로 16비트에 들어가지 않을 때만 wide로 내보낸다
+    int offset = currentChunk()->count - loopStart + 3;
+    if (offset <= UINT16_MAX) {
+        emitShort(OP_LOOP, (uint16_t) offset);
+        return;
+    }
+    emitOp(OP_WIDE);
     emitByte(OP_LOOP);
-
-    int offset = currentChunk()->count - loopStart + 2;
-    if (offset > UINT16_MAX) error("Loop body too large.");
-
-    emitByte((offset >> 8) & 0xff);
-    emitByte(offset & 0xff);
+    emitWord(currentChunk()->count - loopStart + 4);
 }
 
 static int emitJump(uint8_t instruction) {
-    emitByte(instruction); // 바이트 코드에 점프 명령어 추가. jump offset 피연산자는 2바이트를 사용함
+    if (current->wideJumps) {
+        emitOp(OP_WIDE);
+        emitByte(instruction);
+        emitWord(0xffffffff);
+        return currentChunk()->count - 4;
+    }
+    emitOp(instruction); // 바이트 코드에 점프 명령어 추가. jump offset 피연산자는 2바이트를 사용함
     emitByte(0xff); // 16비트 크기의 임시 공간 확보, 일부러 큰 값을 추가하여 나중에 수정 가능.
     emitByte(0xff); //이것도 마찬가지.
     return currentChunk()->count - 2; // 점프 명령어의 위치 반환.
 }
 
 static void patchJump(int offset) {
+    uint8_t *code = currentChunk()->code;
+    resetPeephole(); //현재 위치가 점프 대상이 되었다
+    if (current->wideJumps) {
+        int jump = currentChunk()->count - offset - 4;
+        code[offset] = (jump >> 24) & 0xff;
+        code[offset + 1] = (jump >> 16) & 0xff;
+        code[offset + 2] = (jump >> 8) & 0xff;
+        code[offset + 3] = jump & 0xff;
+        return;
+    }
     //점프 offset 자체를 보정하기 위해 바이트코드에서 2를 뺀다
     int jump = currentChunk()->count - offset - 2;
     if (jump > UINT16_MAX) {
-        //16bit offset
-        error("Too much jump over.");
+        //전방 점프는 offset 자리를 먼저 잡아야 하므로 여기서 넓힐 수 없다. 함수가 끝나면 wide 점프로 다시 컴파일한다
+        current->jumpOverflow = true;
+        return;
+    }
+    code[offset] = (jump >> 8) & 0xff;
+    code[offset + 1] = jump & 0xff;
+}
+
+static int loopLabel() {
+    //뒤로 점프하는 대상(loop 시작, continue 위치)
+    resetPeephole();
+    return currentChunk()->count;
+}
+
+static int emitConditionJump() {
+    //조건이 거짓이면 점프하는 명령어를 내보낸다. 조건을 pop하므로 양쪽 경로 모두 OP_POP이 필요 없다.
+    //조건식이 비교 연산으로 끝났다면 비교와 분기를 명령어 하나로 합친다
+    int prev = current->recentOps[1];
+    int last = current->recentOps[2];
+    uint8_t *code = currentChunk()->code;
+    uint8_t instruction = OP_POP_JUMP_IF_FALSE;
+    int start = last;
+
+    if (last != -1) {
+        switch (code[last]) {
+            case OP_EQUAL:
+                instruction = OP_JUMP_IF_NOT_EQUAL;
+                break;
+            case OP_GREATER:
+                instruction = OP_JUMP_IF_NOT_GREATER;
+                break;
+            case OP_LESS:
+                instruction = OP_JUMP_IF_NOT_LESS;
+                break;
+            case OP_NOT: // a <= b, a >= b는 비교 + OP_NOT으로 컴파일된다
+                if (prev != -1 && code[prev] == OP_GREATER) {
+                    instruction = OP_JUMP_IF_GREATER;
+                    start = prev;
+                } else if (prev != -1 && code[prev] == OP_LESS) {
+                    instruction = OP_JUMP_IF_LESS;
+                    start = prev;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    if (instruction != OP_POP_JUMP_IF_FALSE) rewindTo(start);
+    return emitJump(instruction);
+}
+
+static void emitArithmetic(uint8_t op, uint8_t localsOp) {
+    //두 피연산자가 모두 지역 변수면 OP_GET_LOCAL 두 번과 연산을 하나로 합친다
+    int prev = current->recentOps[1];
+    int last = current->recentOps[2];
+    uint8_t *code = currentChunk()->code;
+    if (prev != -1 && code[prev] == OP_GET_LOCAL && code[last] == OP_GET_LOCAL) {
+        uint8_t a = code[prev + 1];
+        uint8_t b = code[last + 1];
+        rewindTo(prev);
+        emitBytes(localsOp, a);
+        emitByte(b);
+        return;
     }
-    currentChunk()->code[offset] = (jump >> 8) & 0xff;
-    currentChunk()->code[offset + 1] = jump & 0xff;
+    emitOp(op);
+}
+
+static bool emitAddLocalConstant(uint8_t slot) {
+    //"x = x + 상수" 형태의 지역 변수 갱신(for문 증감식 등)을 OP_ADD_LOCAL_CONSTANT 하나로 합친다
+    int *recent = current->recentOps;
+    uint8_t *code = currentChunk()->code;
+    if (recent[0] == -1 ||
+        code[recent[0]] != OP_GET_LOCAL || code[recent[0] + 1] != slot ||
+        (code[recent[1]] != OP_CONSTANT && code[recent[1]] != OP_SMALL_INT) || code[recent[2]] != OP_ADD) {
+        return false;
+    }
+    int constant = code[recent[1] + 1];
+    if (code[recent[1]] == OP_SMALL_INT) {
+        //합친 명령어는 상수 배열에서 피연산자를 읽으므로 작은 정수도 상수로 넣는다 (중복 제거되어 한 번만 들어간다)
+        constant = literalConstant(NUMBER_VAL(constant));
+        if (constant > UINT8_MAX) return false;
+    }
+    rewindTo(recent[0]);
+    emitBytes(OP_ADD_LOCAL_CONSTANT, slot);
+    emitByte(constant);
+    return true;
 }
 
 //static uint8_t makeConstant(Value value) {
@@ -235,6 +484,165 @@ static void patchJump(int offset) {
 //    }
 //}
 
+int stackDepth(ObjFunction *function) {
+    //점프를 따라가며 명령어마다 진입할 때의 스택 깊이를 구한다 (슬롯 0의 클로저와 인자부터 시작).
+    //명령어의 효과만 보므로 peephole이 합치거나 되돌린 코드에도 그대로 맞는다
+    Chunk *chunk = &function->chunk;
+    int *depths = (int *) malloc(sizeof(int) * (chunk->count + 1));
+    int *pending = (int *) malloc(sizeof(int) * (chunk->count + 1)); //아직 따라가지 않은 점프 대상
+    if (depths == NULL || pending == NULL) exit(1);
+    for (int i = 0; i <= chunk->count; i++) depths[i] = -1;
+
+    int peak = function->arity + 1;
+    int pendingCount = 0;
+    depths[0] = peak;
+    pending[pendingCount++] = 0;
+    while (peak >= 0 && pendingCount > 0) {
+        int offset = pending[--pendingCount];
+        while (offset < chunk->count) {
+            int depth = depths[offset];
+            uint8_t *code = chunk->code + offset;
+            bool wide = code[0] == OP_WIDE;
+            uint8_t *operands = code + (wide ? 2 : 1);
+            int width = wide ? 2 : 1;
+            int length = (int) (operands - code);
+            int effect = 0;
+            int extra = 0; //명령어 실행 중에만 잠깐 더 쓰는 슬롯
+            int jump = -1;
+            bool fallsThrough = true;
+            switch (code[wide ? 1 : 0]) {
+                case OP_CONSTANT: case OP_SMALL_INT:
+                    length += 1;
+                    effect = 1;
+                    break;
+                case OP_CONSTANT_LONG:
+                    length += 3;
+                    effect = 1;
+                    break;
+                case OP_NIL: case OP_TRUE: case OP_FALSE:
+                    effect = 1;
+                    break;
+                case OP_GET_LOCAL: case OP_GET_UPVALUE:
+                    length += width;
+                    effect = 1;
+                    break;
+                case OP_SET_LOCAL: case OP_SET_UPVALUE:
+                    length += width;
+                    break;
+                case OP_GET_GLOBAL:
+                    length += 2;
+                    effect = 1;
+                    break;
+                case OP_SET_GLOBAL:
+                    length += 2;
+                    break;
+                case OP_DEFINE_CONST_GLOBAL: case OP_DEFINE_LET_GLOBAL:
+                    length += 2;
+                    effect = -1;
+                    break;
+                case OP_POP: case OP_PRINT: case OP_PRINTLN: case OP_CLOSE_UPVALUE:
+                case OP_EQUAL: case OP_GREATER: case OP_LESS: case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY:
+                case OP_DIVIDE: case OP_MODULO: case OP_ADD_NUM: case OP_ADD_STR: case OP_SUBTRACT_NUM:
+                case OP_MULTIPLY_NUM: case OP_DIVIDE_NUM: case OP_GREATER_NUM: case OP_LESS_NUM:
+                    effect = -1;
+                    break;
+                case OP_EQUAL_PRESERVE: case OP_NOT: case OP_NEGATIVE:
+                    break;
+                case OP_BUILD_STRING:
+                    length += 1;
+                    effect = 1 - operands[0];
+                    break;
+                case OP_CALL:
+                    length += width;
+                    effect = -(wide ? (operands[0] << 8 | operands[1]) : operands[0]);
+                    break;
+                case OP_CLOSURE: {
+                    int constant = wide ? (operands[0] << 8 | operands[1]) : operands[0];
+                    length += width + AS_FUNCTION(chunk->constants.values[constant])->upValueCount * (1 + width);
+                    effect = 1;
+                    break;
+                }
+                case OP_ADD_LOCALS: case OP_SUBTRACT_LOCALS: case OP_MULTIPLY_LOCALS:
+                    length += 2;
+                    effect = 1;
+                    break;
+                case OP_ADD_LOCAL_CONSTANT:
+                    length += 2;
+                    effect = 1;
+                    extra = 1; //문자열이면 지역 변수와 상수를 올려놓고 이어 붙인다
+                    break;
+                case OP_RETURN:
+                    fallsThrough = false;
+                    break;
+                case OP_JUMP: case OP_LOOP: case OP_JUMP_IF_FALSE: case OP_POP_JUMP_IF_FALSE:
+                case OP_JUMP_IF_NOT_EQUAL: case OP_JUMP_IF_NOT_GREATER: case OP_JUMP_IF_NOT_LESS:
+                case OP_JUMP_IF_GREATER: case OP_JUMP_IF_LESS: {
+                    uint8_t instruction = code[wide ? 1 : 0];
+                    length += wide ? 4 : 2;
+                    uint32_t distance = wide
+                                        ? (uint32_t) operands[0] << 24 | (uint32_t) operands[1] << 16 |
+                                          (uint32_t) operands[2] << 8 | operands[3]
+                                        : (uint32_t) (operands[0] << 8 | operands[1]);
+                    jump = instruction == OP_LOOP ? offset + length - (int) distance : offset + length + (int) distance;
+                    if (instruction == OP_POP_JUMP_IF_FALSE) effect = -1;
+                    if (instruction >= OP_JUMP_IF_NOT_EQUAL && instruction <= OP_JUMP_IF_LESS) effect = -2;
+                    fallsThrough = instruction != OP_JUMP && instruction != OP_LOOP;
+                    break;
+                }
+                default:
+                    peak = -1; //알 수 없는 명령어
+                    break;
+            }
+            if (peak < 0) break;
+
+            int after = depth + effect;
+            if (depth + effect + extra > peak) peak = depth + effect + extra;
+            if (after < 0 || offset + length > chunk->count) {
+                peak = -1;
+                break;
+            }
+            if (jump != -1) {
+                if (jump < 0 || jump >= chunk->count) {
+                    peak = -1;
+                    break;
+                }
+                if (depths[jump] == -1) {
+                    depths[jump] = after;
+                    pending[pendingCount++] = jump;
+                } else if (depths[jump] != after) {
+                    peak = -1; //두 경로가 다른 깊이로 만난다
+                    break;
+                }
+            }
+            if (!fallsThrough) break;
+            offset += length;
+            if (depths[offset] != -1) {
+                if (depths[offset] != after) peak = -1;
+                break;
+            }
+            depths[offset] = after;
+        }
+    }
+    free(depths);
+    free(pending);
+    return peak;
+}
+
+static void reserveSlots(int count) {
+    //함수가 쓰는 스택 슬롯의 최댓값. call()이 프레임을 만들기 전에 스택에 여유가 있는지 확인하는 데 쓴다
+    if (count > current->function->maxSlots) current->function->maxSlots = count;
+}
+
+static Local *pushLocal() {
+    if (current->localCount == current->localCapacity) {
+        int oldCapacity = current->localCapacity;
+        current->localCapacity = GROW_CAPACITY(oldCapacity);
+        current->locals = GROW_ARRAY(Local, current->locals, oldCapacity, current->localCapacity);
+    }
+    reserveSlots(current->localCount + 1);
+    return &current->locals[current->localCount++];
+}
+
 static void initCompiler(Compiler *compiler, FunctionType type) {
     compiler->enclosing = current; //나중에 타입 명시하기
     compiler->function = NULL; //후에 gc 추가를 위해서 NULL로 초기화
@@ -244,6 +652,15 @@ static void initCompiler(Compiler *compiler, FunctionType type) {
     compiler->function = newFunction(); //컴파일 타임에 ObjFunction 생성
     current = compiler;
     compiler->unpatchedBreaks = 0;
+    compiler->constants = (ConstantMap) {0};
+    compiler->locals = NULL;
+    compiler->localCapacity = 0;
+    compiler->upValues = NULL;
+    compiler->upValueCapacity = 0;
+    compiler->wideJumps = false;
+    compiler->jumpOverflow = false;
+    compiler->lazy = NULL;
+    resetPeephole();
 
 
     if (type != TYPE_SCRIPT) {
@@ -252,8 +669,9 @@ static void initCompiler(Compiler *compiler, FunctionType type) {
         initArray(&unpatchedBreaks, sizeof(int));
     }
 
-    Local *local = &current->locals[current->localCount++];
+    Local *local = pushLocal();
     local->depth = 0;
+    local->isConst = false;
     local->isCaptured = false;
     local->name.start = "";
     local->name.length = 0;
@@ -261,18 +679,21 @@ static void initCompiler(Compiler *compiler, FunctionType type) {
 
 static ObjFunction *endCompiler() {
     emitReturn();
-    freeArray(&unpatchedBreaks);
     ObjFunction *function = current->function;
+    if (!parser.hadError && !current->jumpOverflow) {
+        //지역 변수만 센 reserveSlots와 달리 식의 중간값까지 포함한 실제 최대 깊이 (fiber의 스택 크기가 이것으로 정해진다)
+        //점프가 넘친 코드는 wideJumps로 다시 컴파일하므로 건너뛴다
+        int depth = stackDepth(function);
+        if (depth < 0) error("Inconsistent stack depth."); //컴파일러의 버그: .loxc 검사도 통과하지 못한다
+        if (depth > function->maxSlots) function->maxSlots = depth;
+        //call()은 maxSlots + UINT8_COUNT개의 슬롯을 요구하므로 이보다 크면 호출할 때마다 "Stack overflow"가 된다
+        if (function->maxSlots + UINT8_COUNT > STACK_MAX) error("Too many local variables in function.");
+    }
+    freeConstantMap(&current->constants);
+    FREE_ARRAY(Local, current->locals, current->localCapacity);
     if (current->type == TYPE_SCRIPT) {
         freeArray(&unpatchedBreaks);
     }
-#ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
-        disassembleChunk(currentChunk(), function->name != NULL
-                                             ? function->name->chars
-                                             : "<script>");
-    }
-#endif
     current = current->enclosing;
     return function;
 }
@@ -287,9 +708,9 @@ static void endScope() {
     while (current->localCount > 0 &&
            current->locals[current->localCount - 1].depth > current->scopeDepth) {
         if (current->locals[current->localCount - 1].isCaptured) {
-            emitByte(OP_CLOSE_UPVALUE);
+            emitOp(OP_CLOSE_UPVALUE);
         } else {
-            emitByte(OP_POP); //지역변수가 스코프를 벗어나면 해당 슬롯은 더 이상 필요가 없다
+            emitOp(OP_POP); //지역변수가 스코프를 벗어나면 해당 슬롯은 더 이상 필요가 없다
         }
         current->localCount--;
     }
@@ -305,8 +726,14 @@ static ParseRule *getRule(TokenType type);
 
 static void parsePrecedence(Precedence precedence);
 
-static uint8_t identifierConstant(Token *name) {
-    return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+static uint16_t identifierSlot(Token *name) {
+    //전역 변수 이름을 컴파일 타임에 vm.globals의 슬롯 인덱스로 해석한다. 런타임에는 해싱 없이 슬롯에 바로 접근
+    int slot = globalSlot(copyString(name->start, name->length));
+    if (slot > UINT16_MAX) {
+        error("Too many global variables.");
+        return 0;
+    }
+    return (uint16_t) slot;
 }
 
 static bool identifiersEqual(Token *a, Token *b) {
@@ -328,7 +755,7 @@ static int resolveLocal(Compiler *compiler, Token *name) {
     return -1; //전역변수임을 나타냄
 }
 
-static int addUpValue(Compiler *compiler, uint8_t index, bool isLocal) {
+static int addUpValue(Compiler *compiler, int index, bool isLocal) {
     int upValueCount = compiler->function->upValueCount;
     for (int i = 0; i < upValueCount; i++) {
         UpValue *upValue = &compiler->upValues[i];
@@ -336,44 +763,56 @@ static int addUpValue(Compiler *compiler, uint8_t index, bool isLocal) {
             return i;
         }
     }
-    if (upValueCount == UINT8_COUNT) {
+    if (upValueCount == UINT16_COUNT) {
         error("Too many closure variables in function.");
         return 0;
     }
+    if (upValueCount == compiler->upValueCapacity) {
+        int oldCapacity = compiler->upValueCapacity;
+        compiler->upValueCapacity = GROW_CAPACITY(oldCapacity);
+        compiler->upValues = GROW_ARRAY(UpValue, compiler->upValues, oldCapacity, compiler->upValueCapacity);
+    }
 
     compiler->upValues[upValueCount].isLocal = isLocal;
-    compiler->upValues[upValueCount].index = index;
+    compiler->upValues[upValueCount].index = (uint16_t) index;
     return compiler->function->upValueCount++;
 }
 
 static int resolveUpValue(Compiler *compiler, Token *name) {
-    if (compiler->enclosing == NULL) return -1;
+    if (compiler->enclosing == NULL) {
+        //실행 중에 컴파일하는 함수: 처음 훑을 때 캡처해둔 이름 중에 있으면 그 upvalue다
+        if (compiler->lazy == NULL) return -1;
+        for (int i = 0; i < compiler->lazy->upValueCount; i++) {
+            if (identifiersEqual(name, &compiler->lazy->names[i])) return i;
+        }
+        return -1;
+    }
 
     int local = resolveLocal(compiler->enclosing, name);
     if (local != -1) { //상위 스코프 변수 인식
         compiler->enclosing->locals[local].isCaptured = true;
-        return addUpValue(compiler, (uint8_t) local, true);
+        return addUpValue(compiler, local, true);
     }
 
     int upValue = resolveUpValue(compiler->enclosing, name);
     if (upValue != -1) {
-        return addUpValue(compiler, (uint8_t) upValue, false);
+        return addUpValue(compiler, upValue, false);
     }
 
     return -1;
 }
 
 static void addLocal(Token name, bool isConst) {
-    if (current->localCount == UINT8_COUNT) {
-        //VM은 스코프에 최대 256개의 지역 변수까지만 지원함
+    if (current->localCount == UINT16_COUNT) {
+        //슬롯 인덱스는 (OP_WIDE를 붙여도) 최대 2바이트 피연산자에 저장됨
         error("Too many local variables in function.");
         return;
     }
-    //인덱스는 1바이트 크기의 피연산자에 저장됨
-    Local *local = &current->locals[current->localCount++];
+    Local *local = pushLocal();
     local->name = name;
     local->depth = -1; //초기화되지 않은 상태 표시, 나중에 변수의 초기자 컴파일이 끝나면 markInitialized()로 초기화가 된 것으로 표시, 선언만 된 상태
     local->isConst = isConst;
+    local->isCaptured = false;
 }
 
 static void declareVariable(bool isConst) {
@@ -393,13 +832,13 @@ static void declareVariable(bool isConst) {
     addLocal(*name, isConst);
 }
 
-static uint8_t parseVariable(const char *errorMessage, bool isConst) {
+static uint16_t parseVariable(const char *errorMessage, bool isConst) {
     consume(TOKEN_IDENTIFIER, errorMessage);
 
     declareVariable(isConst);
     if (current->scopeDepth > 0) return 0;
 
-    return identifierConstant(&parser.previous);
+    return identifierSlot(&parser.previous);
 }
 
 static void markInitialized() {
@@ -407,33 +846,32 @@ static void markInitialized() {
     current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
-static void defineVariable(uint8_t global, bool isConst) {
+static void defineVariable(uint16_t global, bool isConst) {
     //아직 선언만 된 상태
     if (current->scopeDepth > 0) {
         markInitialized(); //초기화됨을 확인
         return;
     }
-    Value dummy;
-    ObjString *name = AS_STRING(currentChunk()->constants.values[global]);
 
-    if (tableGet(&vm.globals, name, &dummy)) {
+    if (!IS_UNDEFINED(vm.globals.values.values[global])) {
+        //이전에 실행된 코드(REPL, native)에서 이미 정의된 전역 변수
         error("Variable already declared.");
     }
 
     if (isConst) {
-        emitBytes(OP_DEFINE_CONST_GLOBAL, global);
+        emitShort(OP_DEFINE_CONST_GLOBAL, global);
     } else {
-        emitBytes(OP_DEFINE_LET_GLOBAL, global);
+        emitShort(OP_DEFINE_LET_GLOBAL, global);
     }
 }
 
-static uint8_t argumentList() {
-    uint8_t argCount = 0;
+static int argumentList() {
+    int argCount = 0;
     if (!check(TOKEN_RIGHT_PAREN)) {
         do {
             expression();
-            if (argCount == 255) {
-                error("Can't have more than 255 arguments.");
+            if (argCount == UINT16_MAX) {
+                error("Can't have more than 65535 arguments.");
             }
             argCount++;
         } while (match(TOKEN_COMMA));
@@ -446,15 +884,16 @@ static void and_(bool canAss) {
     // 이 함수가 호출될 때 이미 좌측 표현식은 컴파일 된 상태
     int endJump = emitJump(OP_JUMP_IF_FALSE);
 
-    emitByte(OP_POP);
+    emitOp(OP_POP);
     parsePrecedence(PREC_AND);
 
     patchJump(endJump);
 }
 
 static void call(bool canAssign) {
-    uint8_t argCount = argumentList();
-    emitBytes(OP_CALL, argCount);
+    int argCount = argumentList();
+    reserveSlots(current->localCount + argCount + 1);
+    emitOperand(OP_CALL, argCount);
 }
 
 static void binary(bool canAssign) {
@@ -464,37 +903,40 @@ static void binary(bool canAssign) {
 
     switch (operatorType) {
         case TOKEN_BANG_EQUAL:
-            emitBytes(OP_EQUAL, OP_NOT);
+            emitOp(OP_EQUAL);
+            emitOp(OP_NOT);
             break;
         case TOKEN_EQUAL_EQUAL:
-            emitByte(OP_EQUAL);
+            emitOp(OP_EQUAL);
             break;
         case TOKEN_GREATER:
-            emitByte(OP_GREATER);
+            emitOp(OP_GREATER);
             break;
         case TOKEN_GREATER_EQUAL:
-            emitBytes(OP_LESS, OP_NOT);
+            emitOp(OP_LESS);
+            emitOp(OP_NOT);
             break;
         case TOKEN_LESS:
-            emitByte(OP_LESS);
+            emitOp(OP_LESS);
             break;
         case TOKEN_LESS_EQUAL:
-            emitBytes(OP_GREATER, OP_NOT);
+            emitOp(OP_GREATER);
+            emitOp(OP_NOT);
             break;
         case TOKEN_PLUS:
-            emitByte(OP_ADD);
+            emitArithmetic(OP_ADD, OP_ADD_LOCALS);
             break;
         case TOKEN_MINUS:
-            emitByte(OP_SUBTRACT);
+            emitArithmetic(OP_SUBTRACT, OP_SUBTRACT_LOCALS);
             break;
         case TOKEN_STAR:
-            emitByte(OP_MULTIPLY);
+            emitArithmetic(OP_MULTIPLY, OP_MULTIPLY_LOCALS);
             break;
         case TOKEN_SLASH:
-            emitByte(OP_DIVIDE);
+            emitOp(OP_DIVIDE);
             break;
         case TOKEN_PERCENT:
-            emitByte(OP_MODULO);
+            emitOp(OP_MODULO);
             break;
         default:
             return;
@@ -504,13 +946,13 @@ static void binary(bool canAssign) {
 static void literal(bool canAssgin) {
     switch (parser.previous.type) {
         case TOKEN_FALSE:
-            emitByte(OP_FALSE);
+            emitOp(OP_FALSE);
             break;
         case TOKEN_NIL:
-            emitByte(OP_NIL);
+            emitOp(OP_NIL);
             break;
         case TOKEN_TRUE:
-            emitByte(OP_TRUE);
+            emitOp(OP_TRUE);
             break;
         default:
             return; //실행되지 않은 코드
@@ -524,19 +966,21 @@ static void grouping(bool canAssign) {
 
 static void number(bool canAssign) {
     double value = strtod(parser.previous.start, NULL);
+    if (value >= 0 && value <= UINT8_MAX && value == (int) value) {
+        emitBytes(OP_SMALL_INT, (uint8_t) value); //작은 정수는 상수 배열을 거치지 않고 operand로 바로 싣는다
+        return;
+    }
     emitConstant(NUMBER_VAL(value));
 }
 
 static void conditional(bool canAssign) {
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    int thenJump = emitConditionJump();
 
     //then branch
     parsePrecedence(PREC_CONDITIONAL);
     int elseJump = emitJump(OP_JUMP);
 
     patchJump(thenJump);
-    emitByte(OP_POP);
     consume(TOKEN_COLON, "Expect ':' after then branch of conditional operator.");
 
     //else branch
@@ -549,7 +993,7 @@ static void or_(bool canAssign) {
     int endJump = emitJump(OP_JUMP);
 
     patchJump(elseJump);
-    emitByte(OP_POP);
+    emitOp(OP_POP);
 
     parsePrecedence(PREC_OR);
     patchJump(endJump);
@@ -560,37 +1004,41 @@ static void interpolation(bool canAssign);
 static void string(bool canAssign) {
     emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2))); // 전후 " 제거
     while (match(TOKEN_INTERPOLATION)) {
-        emitByte(OP_ADD);
         interpolation(canAssign);
+        emitOp(OP_ADD);
+    }
+}
+
+static int interpolationPiece(int pieces) {
+    //OP_BUILD_STRING의 operand는 1바이트이므로 조각이 255개 차면 먼저 합쳐서 조각 하나로 만든다
+    if (pieces == UINT8_MAX) {
+        emitBytes(OP_BUILD_STRING, UINT8_MAX);
+        pieces = 1;
+    }
+    return pieces + 1;
+}
+
+static void interpolationLiteral(int *pieces) {
+    //보간 토큰 사이의 문자열 조각 ("a${, }b${, }c"). 비어 있으면 건너뛴다
+    if (parser.previous.length > 2) {
+        *pieces = interpolationPiece(*pieces);
+        emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2)));
     }
 }
 
 static void interpolation(bool canAssign) {
-    int count = 0;
+    //"a${x}b${y}c": 조각들을 모두 스택에 올린 뒤 OP_BUILD_STRING 한 번으로 합친다 (중간 문자열을 만들지 않는다)
+    (void) canAssign;
+    int pieces = 0;
     do {
-        bool concatenate = false;
-        bool isString = false;
-        if (parser.previous.length > 2) {
-            string(canAssign);
-            concatenate = true;
-            isString = true;
-            if (count > 0) emitByte(OP_ADD);
-        }
-
+        interpolationLiteral(&pieces);
+        pieces = interpolationPiece(pieces);
         expression(); // 표현식 평가
-
-        emitByte(OP_TOSTRING);
-        if (concatenate || (count >= 1 && !isString)) {
-            emitByte(OP_ADD);
-        }
-        count++;
     } while (match(TOKEN_INTERPOLATION));
 
     consume(TOKEN_STRING, "Expect end of string interpolation.");
-    if (parser.previous.length > 2) {
-        string(canAssign);
-        emitByte(OP_ADD);
-    }
+    interpolationLiteral(&pieces);
+    emitBytes(OP_BUILD_STRING, (uint8_t) pieces);
 }
 
 
@@ -607,21 +1055,22 @@ static void namedVariable(Token name, bool canAssign) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
-        arg = identifierConstant(&name);
+        uint16_t slot = identifierSlot(&name);
         if (canAssign && match(TOKEN_EQUAL)) {
             //전역 변수의 재할당 검증
             expression();
-            emitBytes(OP_SET_GLOBAL, (uint8_t) arg);
-            return;
+            emitShort(OP_SET_GLOBAL, slot);
+        } else {
+            emitShort(OP_GET_GLOBAL, slot);
         }
-        getOp = OP_GET_GLOBAL;
-        setOp = OP_SET_GLOBAL;
+        return;
     }
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
-        emitBytes(setOp, (uint8_t) arg);
+        if (setOp == OP_SET_LOCAL && arg <= UINT8_MAX && emitAddLocalConstant((uint8_t) arg)) return;
+        emitOperand(setOp, arg);
     } else {
-        emitBytes(getOp, (uint8_t) arg);
+        emitOperand(getOp, arg);
     }
 }
 
@@ -637,10 +1086,10 @@ static void unary(bool canAssign) {
     //연산자 명령어
     switch (operatorType) {
         case TOKEN_BANG:
-            emitByte(OP_NOT);
+            emitOp(OP_NOT);
             break;
         case TOKEN_MINUS:
-            emitByte(OP_NEGATIVE);
+            emitOp(OP_NEGATIVE);
             break;
         default:
             return; //실행되지 않은 코드
@@ -745,9 +1194,10 @@ static void block() {
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void function(FunctionType type) {
-    Compiler compiler;
-    initCompiler(&compiler, type);
+static ObjFunction *functionBody(Compiler *compiler, FunctionType type, LazyFunction *lazy, bool wideJumps) {
+    initCompiler(compiler, type);
+    compiler->wideJumps = wideJumps;
+    compiler->lazy = lazy;
     beginScope();
 
     consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
@@ -755,10 +1205,10 @@ static void function(FunctionType type) {
     if (!check(TOKEN_RIGHT_PAREN)) {
         do {
             current->function->arity++;
-            if (current->function->arity > 255) {
-                errorAtCurrent("Can't have more than 255 parameters.");
+            if (current->function->arity > UINT16_MAX) {
+                errorAtCurrent("Can't have more than 65535 parameters.");
             }
-            uint8_t constant = parseVariable("Expect parameter name.", true);
+            uint16_t constant = parseVariable("Expect parameter name.", true);
             defineVariable(constant, true);
         } while (match(TOKEN_COMMA));
     }
@@ -767,17 +1217,134 @@ static void function(FunctionType type) {
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
     block();
 
-    ObjFunction *function = endCompiler();
-    emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+    return endCompiler();
+}
 
+static void emitClosure(ObjFunction *function, UpValue *upValues) {
+    int constant = makeConstant(OBJ_VAL(function));
+    if (constant > UINT16_MAX) {
+        //OP_CLOSURE의 상수 피연산자는 OP_WIDE를 붙여도 2바이트다
+        error("Too many constants in one chunk.");
+        return;
+    }
+    bool wide = constant > UINT8_MAX;
     for (int i = 0; i < function->upValueCount; i++) {
-        emitByte(compiler.upValues[i].isLocal ? 1 : 0);
-        emitByte(compiler.upValues[i].index);
+        if (upValues[i].index > UINT8_MAX) wide = true;
+    }
+    //upvalue 인덱스는 OP_CLOSURE의 피연산자이므로 상수 인덱스와 함께 넓힌다 (OP_WIDE면 모두 2바이트)
+    if (wide) {
+        emitOp(OP_WIDE);
+        emitByte(OP_CLOSURE);
+        emitByte((constant >> 8) & 0xff);
+        emitByte(constant & 0xff);
+    } else {
+        emitBytes(OP_CLOSURE, (uint8_t) constant);
+    }
+
+    for (int i = 0; i < function->upValueCount; i++) {
+        uint16_t index = upValues[i].index;
+        emitByte(upValues[i].isLocal ? 1 : 0);
+        if (wide) emitByte((index >> 8) & 0xff);
+        emitByte(index & 0xff);
     }
 }
 
+static void captureName(LazyFunction *lazy, Token *name) {
+    //본문에 나온 이름이 바깥 함수의 지역 변수나 upvalue면 캡처한다. 본문 안에서 가려진 이름까지 캡처할 수 있지만
+    //(필요 이상으로 닫힐 뿐) 결과는 같다. 전역 변수와 본문의 지역 변수는 여기서 찾지 못하므로 건너뛴다
+    for (int i = 0; i < lazy->upValueCount; i++) {
+        if (identifiersEqual(name, &lazy->names[i])) return;
+    }
+    int index = -1;
+    bool isLocal = false;
+    for (int i = current->localCount - 1; i >= 0; i--) {
+        if (current->locals[i].depth != -1 && identifiersEqual(name, &current->locals[i].name)) {
+            current->locals[i].isCaptured = true;
+            index = i;
+            isLocal = true;
+            break;
+        }
+    }
+    if (index == -1) index = resolveUpValue(current, name);
+    if (index == -1) return;
+
+    if (lazy->upValueCount == UINT16_COUNT) {
+        error("Too many closure variables in function.");
+        return;
+    }
+    if (lazy->upValueCount == lazy->capacity) {
+        int oldCapacity = lazy->capacity;
+        lazy->capacity = GROW_CAPACITY(oldCapacity);
+        lazy->names = GROW_ARRAY(Token, lazy->names, oldCapacity, lazy->capacity);
+        lazy->upValues = GROW_ARRAY(UpValue, lazy->upValues, oldCapacity, lazy->capacity);
+    }
+    lazy->names[lazy->upValueCount] = *name;
+    lazy->upValues[lazy->upValueCount].index = (uint16_t) index;
+    lazy->upValues[lazy->upValueCount].isLocal = isLocal;
+    lazy->upValueCount++;
+}
+
+static void lazyFunction() {
+    //--lazy: 본문을 컴파일하지 않고 토큰만 훑어서 끝과 캡처할 변수를 찾은 뒤, 빈 함수(stub)의 클로저를 내보낸다.
+    //본문은 처음 호출될 때 compileLazyFunction()이 저장해둔 위치부터 다시 읽어서 컴파일한다
+    LazyFunction *lazy = ALLOCATE(LazyFunction, 1);
+    *lazy = (LazyFunction) {.source = lazySource, .scanner = saveScanner(), .name = parser.previous,
+                            .paren = parser.current};
+
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(TOKEN_RIGHT_PAREN)) {
+        do {
+            consume(TOKEN_IDENTIFIER, "Expect parameter name.");
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    int depth = 1;
+    while (!check(TOKEN_EOF)) {
+        if (check(TOKEN_LEFT_BRACE)) {
+            depth++;
+        } else if (check(TOKEN_RIGHT_BRACE) && --depth == 0) {
+            break;
+        } else if (check(TOKEN_IDENTIFIER)) {
+            captureName(lazy, &parser.current);
+        }
+        advance();
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+
+    ObjFunction *function = newFunction();
+    function->lazy = lazy;
+    function->upValueCount = lazy->upValueCount;
+    push(OBJ_VAL(function));
+    function->name = copyString(lazy->name.start, lazy->name.length);
+    emitClosure(function, lazy->upValues);
+    pop();
+    FREE_ARRAY(UpValue, lazy->upValues, lazy->capacity);
+    lazy->upValues = NULL;
+}
+
+static void function(FunctionType type) {
+    if (lazySource != NULL) {
+        lazyFunction();
+        return;
+    }
+    Scanner scannerStart = saveScanner();
+    Parser parserStart = parser;
+    Compiler compiler;
+    ObjFunction *function = functionBody(&compiler, type, NULL, false);
+    if (compiler.jumpOverflow && !parser.hadError) {
+        //본문의 전방 점프가 64KB를 넘었다. 매개변수부터 다시 읽으면서 이 함수의 점프를 모두 wide로 내보낸다
+        FREE_ARRAY(UpValue, compiler.upValues, compiler.upValueCapacity);
+        restoreScanner(scannerStart);
+        parser = parserStart;
+        function = functionBody(&compiler, type, NULL, true);
+    }
+    emitClosure(function, compiler.upValues);
+    FREE_ARRAY(UpValue, compiler.upValues, compiler.upValueCapacity);
+}
+
 static void funDeclaration() {
-    uint8_t global = parseVariable("Expect function name.", true);
+    uint16_t global = parseVariable("Expect function name.", true);
     markInitialized();
     function(TYPE_FUNCTION);
     defineVariable(global, true);
@@ -786,14 +1353,14 @@ static void funDeclaration() {
 
 static void varDeclaration(bool isConst) {
     //변수 이름에 대한 식별자 토큰 소비, 렉심을 청크의 상수 테이블에 문자열로 추가, 해당 상수 테이블의 인덱스를 return
-    uint8_t global = parseVariable("Expect variable name.", isConst);
+    uint16_t global = parseVariable("Expect variable name.", isConst);
 
     if (match(TOKEN_EQUAL)) {
         expression();
     } else if (isConst) {
         error("'const' variable must be initialized.");
     } else {
-        emitByte(OP_NIL);
+        emitOp(OP_NIL);
     }
     consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
 
@@ -803,7 +1370,7 @@ static void varDeclaration(bool isConst) {
 static void expressionStatement() {
     expression();
     consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-    emitByte(OP_POP); //시맨틱상 표현문은 표현식을 평가는 하지만 그 결과는 버린다
+    emitOp(OP_POP); //시맨틱상 표현문은 표현식을 평가는 하지만 그 결과는 버린다
 }
 
 static void forStatement() {
@@ -820,7 +1387,7 @@ static void forStatement() {
     } else {
         expressionStatement();
     }
-    int loopStart = currentChunk()->count;
+    int loopStart = loopLabel();
     //for exit
     int exitJump = -1;
     if (!match(TOKEN_SEMICOLON)) {
@@ -828,15 +1395,14 @@ static void forStatement() {
         consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
         // Jump out of the loop if the condition is false.
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP); // Condition.
+        exitJump = emitConditionJump();
     }
 
     if (!match(TOKEN_RIGHT_PAREN)) {
         int bodyJump = emitJump(OP_JUMP);
-        int incrementStart = currentChunk()->count;
+        int incrementStart = loopLabel();
         expression();
-        emitByte(OP_POP);
+        emitOp(OP_POP);
         consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
 
         emitLoop(loopStart);
@@ -845,8 +1411,10 @@ static void forStatement() {
     }
     Loop loop = {
         .enclosing = currentLoop,
+        .compiler = current,
         .continueOffset = loopStart,
         .unpatchedBreakJumps = 0,
+        .scopeDepth = current->scopeDepth,
     };
     currentLoop = &loop;
     statement(); //increment
@@ -859,7 +1427,6 @@ static void forStatement() {
     //exit jump
     if (exitJump != -1) {
         patchJump(exitJump);
-        emitByte(OP_POP); // Condition.
     }
 
     for (int i = unpatchedBreaks.count - breakStatementsToBePatched; i < unpatchedBreaks.count; i++) {
@@ -874,28 +1441,29 @@ static void ifStatement() {
     expression(); //런타임 조건값은 스택 맨 위에 남을 것이다
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after 'if.");
 
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    int thenJump = emitConditionJump();
     statement();
 
-    int elseJump = emitJump(OP_JUMP);
-    patchJump(thenJump);
-    emitByte(OP_POP);
-
-    if (match(TOKEN_ELSE)) statement();
-    patchJump(elseJump);
+    if (match(TOKEN_ELSE)) {
+        int elseJump = emitJump(OP_JUMP);
+        patchJump(thenJump);
+        statement();
+        patchJump(elseJump);
+    } else {
+        patchJump(thenJump); //else가 없으면 then 끝에서 점프할 필요가 없다
+    }
 }
 
 static void printLineStatement() {
     expression(); //print문은 표현식을 평가하고 그 결과를 출력함
     consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    emitByte(OP_PRINTLN);
+    emitOp(OP_PRINTLN);
 }
 
 static void printStatement() {
     expression(); //print문은 표현식을 평가하고 그 결과를 출력함
     consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    emitByte(OP_PRINT);
+    emitOp(OP_PRINT);
 }
 
 static void returnStatement() {
@@ -908,21 +1476,23 @@ static void returnStatement() {
     } else {
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
-        emitByte(OP_RETURN);
+        emitOp(OP_RETURN);
     }
 }
 
 static void whileStatement() {
-    int loopStart = currentChunk()->count;
+    int loopStart = loopLabel();
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after 'while'.");
 
-    int loopExitJump = emitJump(OP_JUMP_IF_FALSE);
+    int loopExitJump = emitConditionJump();
     Loop loop = {
         .enclosing = currentLoop,
+        .compiler = current,
         .continueOffset = loopStart,
         .unpatchedBreakJumps = 0,
+        .scopeDepth = current->scopeDepth,
     };
     currentLoop = &loop;
     statement();
@@ -933,7 +1503,6 @@ static void whileStatement() {
 
     emitLoop(loopStart);
     patchJump(loopExitJump);
-    emitByte(OP_POP);
 
     for (int i = unpatchedBreaks.count - breakStatementsToBePatched; i < unpatchedBreaks.count; i++) {
         patchJump(READ_AS(int, &unpatchedBreaks, i));
@@ -952,29 +1521,27 @@ static void switchStatement() {
 
     while (match(TOKEN_CASE)) {
         expression(); // The case expression to compare to the main switch expression.
-        emitByte(OP_EQUAL_PRESERVE);
-        int nextCaseJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP); // Pop the result of the equality check
-        emitByte(OP_POP); // Pop the switch statement expression
+        emitOp(OP_EQUAL_PRESERVE);
+        int nextCaseJump = emitJump(OP_POP_JUMP_IF_FALSE); // Pops the result of the equality check
+        emitOp(OP_POP); // Pop the switch statement expression
         consume(TOKEN_COLON, "Expect ':' after case expression.");
         statement(); // The body of the case statement to run if true
         int exitJump = emitJump(OP_JUMP);
         writeArray(&caseExitJumps, &exitJump);
         // If the case does not match, jump over the case body.
         patchJump(nextCaseJump);
-        emitByte(OP_POP); // Pop the result of the equality check
     }
 
     int defaultCaseExitJump = -1;
     if (match(TOKEN_DEFAULT)) {
-        emitByte(OP_POP); // Pop the switch statement expression
+        emitOp(OP_POP); // Pop the switch statement expression
         consume(TOKEN_COLON, "Expect ':' after 'default'.");
         statement(); // The body of the default case statement
         defaultCaseExitJump = emitJump(OP_JUMP); // Jump over the fallthrough OP_POP instruction
     }
 
     // For the switch statement expression
-    emitByte(OP_POP);
+    emitOp(OP_POP);
     if (defaultCaseExitJump != -1) patchJump(defaultCaseExitJump);
 
     for (int i = 0; i < caseExitJumps.count; i++) {
@@ -986,20 +1553,32 @@ static void switchStatement() {
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after switch statement.");
 }
 
+static void discardLoopLocals() {
+    //루프 본문의 블록 끝(endScope)을 건너뛰므로 그 사이에 선언된 지역 변수를 여기서 정리한다.
+    //컴파일은 블록 끝까지 계속되므로 localCount는 그대로 둔다 (점프 대상과 스택 깊이가 맞아야 한다)
+    for (int i = current->localCount - 1; i >= 0 && current->locals[i].depth > currentLoop->scopeDepth; i--) {
+        emitOp(current->locals[i].isCaptured ? OP_CLOSE_UPVALUE : OP_POP);
+    }
+}
+
 static void continueStatement() {
     consume(TOKEN_SEMICOLON, "Expect ';' after 'continue'.");
-    if (currentLoop == NULL) {
+    if (currentLoop == NULL || currentLoop->compiler != current) {
         error("Can't use 'continue' outside of a loop.");
+        return;
     }
+    discardLoopLocals();
     emitLoop(currentLoop->continueOffset);
 }
 
 static void breakStatement() {
     //breakStatement -> "break" ";" ;
     consume(TOKEN_SEMICOLON, "Expect ';' after 'break'.");
-    if (currentLoop == NULL) {
+    if (currentLoop == NULL || currentLoop->compiler != current) {
         error("Can't use 'break' outside of a loop.");
+        return;
     }
+    discardLoopLocals();
     int loopExitJump = emitJump(OP_JUMP);
     writeArray(&unpatchedBreaks, &loopExitJump);
     currentLoop->unpatchedBreakJumps += 1;
@@ -1075,10 +1654,40 @@ static void statement() {
     }
 }
 
-ObjFunction *compile(const char *source) {
+void markCompilerRoots() {
+    //컴파일 중인 함수들은 아직 어디에도 연결되지 않았으므로 GC root로 취급한다
+    Compiler *compiler = current;
+    while (compiler != NULL) {
+        markObject((Obj *) compiler->function);
+        compiler = compiler->enclosing;
+    }
+    markObject((Obj *) lazySource);
+}
+
+void markLazyFunction(LazyFunction *lazy) {
+    markObject((Obj *) lazy->source);
+}
+
+void freeLazyFunction(LazyFunction *lazy) {
+    FREE_ARRAY(Token, lazy->names, lazy->capacity);
+    if (lazy->upValues != NULL) FREE_ARRAY(UpValue, lazy->upValues, lazy->capacity);
+    FREE(LazyFunction, lazy);
+}
+
+static void printFunctionCode(ObjFunction *function) {
+    //중첩된 함수를 먼저 출력한다 (함수 컴파일이 끝나는 순서). 재컴파일로 버려진 함수는 여기에 나오지 않는다
+    if (function->lazy != NULL) return; //본문은 처음 호출될 때 컴파일하면서 출력한다
+    ValueArray *constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_FUNCTION(constants->values[i])) printFunctionCode(AS_FUNCTION(constants->values[i]));
+    }
+    disassembleChunk(&function->chunk, function->name != NULL ? function->name->chars : "<script>");
+}
+
+static ObjFunction *compileScript(const char *source, Compiler *compiler, bool wideJumps) {
     initScanner(source);
-    Compiler compiler;
-    initCompiler(&compiler, TYPE_SCRIPT);
+    initCompiler(compiler, TYPE_SCRIPT);
+    compiler->wideJumps = wideJumps;
     parser.hadError = false;
     parser.panicMode = false;
 
@@ -1087,6 +1696,62 @@ ObjFunction *compile(const char *source) {
         //eof를 못 찾아서 무한루프
         declaration();
     }
-    ObjFunction *function = endCompiler();
-    return parser.hadError ? NULL : function;
+    return endCompiler();
+}
+
+ObjFunction *compile(const char *source) {
+    if (vm.lazyCompile) {
+        //함수 stub은 실행 중에 소스를 다시 읽으므로, 호출한 쪽의 버퍼(REPL의 한 줄 등) 대신 GC가 관리하는 복사본을 컴파일한다
+        lazySource = copyString(source, (int) strlen(source));
+        source = lazySource->chars;
+    }
+    Compiler compiler;
+    ObjFunction *function = compileScript(source, &compiler, false);
+    if (compiler.jumpOverflow && !parser.hadError) {
+        //최상위 코드의 전방 점프가 64KB를 넘었다: 처음부터 wide 점프로 다시 컴파일한다
+        function = compileScript(source, &compiler, true);
+    }
+    lazySource = NULL;
+    if (parser.hadError) return NULL;
+    if (vm.printCode) printFunctionCode(function);
+    return function;
+}
+
+static ObjFunction *compileLazyBody(Compiler *compiler, LazyFunction *lazy, bool wideJumps) {
+    //함수를 처음 훑기 직전의 상태('(' 앞)로 되돌린 뒤 보통 함수처럼 컴파일한다
+    restoreScanner(lazy->scanner);
+    parser.previous = lazy->name;
+    parser.current = lazy->paren;
+    parser.hadError = false;
+    parser.panicMode = false;
+    currentLoop = NULL;
+    unpatchedBreaks.count = 0;
+    return functionBody(compiler, TYPE_FUNCTION, lazy, wideJumps);
+}
+
+bool compileLazyFunction(ObjFunction *function) {
+    //stub을 호출하는 클로저들이 이미 있으므로 새로 컴파일한 chunk를 stub으로 옮긴다.
+    //upvalue 배치는 처음 훑을 때 정해졌고, 본문의 이름은 lazy->names로 그 번호를 찾는다
+    LazyFunction *lazy = function->lazy;
+    lazySource = lazy->source;
+    initArray(&unpatchedBreaks, sizeof(int));
+    Compiler compiler;
+    ObjFunction *compiled = compileLazyBody(&compiler, lazy, false);
+    if (compiler.jumpOverflow && !parser.hadError) {
+        compiled = compileLazyBody(&compiler, lazy, true);
+    }
+    FREE_ARRAY(UpValue, compiler.upValues, compiler.upValueCapacity);
+    freeArray(&unpatchedBreaks);
+    lazySource = NULL;
+    if (parser.hadError) return false;
+
+    function->arity = compiled->arity;
+    function->maxSlots = compiled->maxSlots;
+    freeChunk(&function->chunk);
+    function->chunk = compiled->chunk;
+    initChunk(&compiled->chunk);
+    function->lazy = NULL;
+    freeLazyFunction(lazy);
+    if (vm.printCode) printFunctionCode(function);
+    return true;
 }
@@ -6,4 +6,16 @@
 
 ObjFunction* compile(const char *source);
 
+void markCompilerRoots();
+
+//--lazy로 만든 함수의 본문을 컴파일해서 function을 채운다. 컴파일 에러가 있으면 false
+bool compileLazyFunction(ObjFunction *function);
+
+//함수가 쓰는 값 스택의 최대 깊이 (지역 변수와 식의 중간값). 점프가 서로 다른 깊이로 만나는 잘못된 코드면 -1
+int stackDepth(ObjFunction *function);
+
+void markLazyFunction(struct LazyFunction *lazy);
+
+void freeLazyFunction(struct LazyFunction *lazy);
+
 #endif //CLOX_COMPILER_H
@@ -4,6 +4,7 @@
 
 #include "object.h"
 #include "value.h"
+#include "vm.h"
 
 void disassembleChunk(Chunk *chunk, const char *name) {
     printf("== %s ==\n", name);
@@ -17,7 +18,7 @@ static int constantInstruction(const char *name, Chunk *chunk,
                                int offset) {
     uint8_t constant = chunk->code[offset + 1];
     printf("%-16s %4d '", name, constant);
-    printValue(chunk->constants.values[constant]);
+    printValue(stdout, chunk->constants.values[constant]);
     printf("'\n");
     return offset + 2;
 }
@@ -27,7 +28,7 @@ static int invokeInstruction(const char *name, Chunk *chunk,
     uint8_t constant = chunk->code[offset + 1];
     uint8_t argCount = chunk->code[offset + 2];
     printf("%-16s (%d args) %4d '", name, argCount, constant);
-    printValue(chunk->constants.values[constant]);
+    printValue(stdout, chunk->constants.values[constant]);
     printf("'\n");
     return offset + 3;
 }
@@ -53,17 +54,107 @@ static int jumpInstruction(const char *name, int sign,
     return offset + 3;
 }
 
+static int globalInstruction(const char *name, Chunk *chunk, int offset) {
+    uint16_t slot = (uint16_t) (chunk->code[offset + 1] << 8);
+    slot |= chunk->code[offset + 2];
+    printf("%-16s %4d '%s'\n", name, slot,
+           READ_AS(GlobalVar, &vm.globals.vars, slot).name->chars);
+    return offset + 3;
+}
+
+static int localsInstruction(const char *name, Chunk *chunk, int offset) {
+    uint8_t a = chunk->code[offset + 1];
+    uint8_t b = chunk->code[offset + 2];
+    printf("%-16s %4d %4d\n", name, a, b);
+    return offset + 3;
+}
+
+static int localConstantInstruction(const char *name, Chunk *chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(stdout, chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
 static int longConstantInstruction(const char *name, Chunk *chunk, int offset) {
     int constant = (chunk->code[offset + 1] << 16) |
                    (chunk->code[offset + 2] << 8) |
                    chunk->code[offset + 3];
 
     printf("%-16s %4d '", name, constant);
-    printValue(chunk->constants.values[constant]);
+    printValue(stdout, chunk->constants.values[constant]);
     printf("'\n");
     return offset + 4;
 }
 
+static int closureInstruction(const char *name, Chunk *chunk, int offset, bool wide) {
+    //wide면 상수 인덱스와 upvalue 인덱스가 2바이트
+    int constant = chunk->code[offset++];
+    if (wide) constant = (constant << 8) | chunk->code[offset++];
+    printf("%-16s %4d ", name, constant);
+    printValue(stdout, chunk->constants.values[constant]);
+    printf("\n");
+
+    ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
+    for (int i = 0; i < function->upValueCount; i++) {
+        int start = offset;
+        int isLocal = chunk->code[offset++];
+        int index = chunk->code[offset++];
+        if (wide) index = (index << 8) | chunk->code[offset++];
+        printf("%04d    |                %s %d\n", start, isLocal ? "local" : "upvalue", index);
+    }
+    return offset;
+}
+
+static int wideInstruction(Chunk *chunk, int offset) {
+    //OP_WIDE 접두사 + 명령어를 한 줄로 출력한다. 피연산자는 2바이트, 점프 offset은 4바이트
+    uint8_t *code = chunk->code;
+    uint8_t instruction = code[offset + 1];
+    int operand = (code[offset + 2] << 8) | code[offset + 3];
+    uint32_t jump = (uint32_t) code[offset + 2] << 24 | (uint32_t) code[offset + 3] << 16 |
+                    (uint32_t) code[offset + 4] << 8 | code[offset + 5];
+    const char *name;
+    int sign = 1;
+    switch (instruction) {
+        case OP_GET_LOCAL:
+            printf("%-16s %4d\n", "OP_GET_LOCAL_W", operand);
+            return offset + 4;
+        case OP_SET_LOCAL:
+            printf("%-16s %4d\n", "OP_SET_LOCAL_W", operand);
+            return offset + 4;
+        case OP_GET_UPVALUE:
+            printf("%-16s %4d\n", "OP_GET_UPVALUE_W", operand);
+            return offset + 4;
+        case OP_SET_UPVALUE:
+            printf("%-16s %4d\n", "OP_SET_UPVALUE_W", operand);
+            return offset + 4;
+        case OP_CALL:
+            printf("%-16s %4d\n", "OP_CALL_W", operand);
+            return offset + 4;
+        case OP_CLOSURE:
+            return closureInstruction("OP_CLOSURE_W", chunk, offset + 2, true);
+        case OP_LOOP:
+            sign = -1;
+            name = "OP_LOOP_W";
+            break;
+        case OP_JUMP: name = "OP_JUMP_W"; break;
+        case OP_JUMP_IF_FALSE: name = "OP_JUMP_IF_FALSE_W"; break;
+        case OP_POP_JUMP_IF_FALSE: name = "OP_POP_JUMP_IF_FALSE_W"; break;
+        case OP_JUMP_IF_NOT_EQUAL: name = "OP_JUMP_IF_NOT_EQUAL_W"; break;
+        case OP_JUMP_IF_NOT_GREATER: name = "OP_JUMP_IF_NOT_GREATER_W"; break;
+        case OP_JUMP_IF_NOT_LESS: name = "OP_JUMP_IF_NOT_LESS_W"; break;
+        case OP_JUMP_IF_GREATER: name = "OP_JUMP_IF_GREATER_W"; break;
+        case OP_JUMP_IF_LESS: name = "OP_JUMP_IF_LESS_W"; break;
+        default:
+            printf("Unknown wide opcode %d\n", instruction);
+            return offset + 2;
+    }
+    printf("%-16s %4d -> %lld\n", name, offset, offset + 6 + sign * (long long) jump);
+    return offset + 6;
+}
+
 int disassembleInstruction(Chunk *chunk, int offset) {
     printf("%04d ", offset);
     int line = chunk->lines[offset];
@@ -78,6 +169,8 @@ int disassembleInstruction(Chunk *chunk, int offset) {
             return constantInstruction("OP_CONSTANT", chunk, offset);
         case OP_CONSTANT_LONG:
             return longConstantInstruction("OP_CONSTANT_LONG", chunk, offset);
+        case OP_SMALL_INT:
+            return byteInstruction("OP_SMALL_INT", chunk, offset);
         case OP_NIL:
             return simpleInstruction("OP_NIL", offset);
         case OP_TRUE:
@@ -91,13 +184,13 @@ int disassembleInstruction(Chunk *chunk, int offset) {
         case OP_SET_LOCAL:
             return byteInstruction("OP_SET_LOCAL", chunk, offset);
         case OP_GET_GLOBAL:
-            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_GET_GLOBAL", chunk, offset);
         case OP_DEFINE_CONST_GLOBAL:
-            return constantInstruction("OP_DEFINE_CONST_GLOBAL", chunk, offset);
+            return globalInstruction("OP_DEFINE_CONST_GLOBAL", chunk, offset);
         case OP_DEFINE_LET_GLOBAL:
-            return constantInstruction("OP_DEFINE_LET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_DEFINE_LET_GLOBAL", chunk, offset);
         case OP_SET_GLOBAL:
-            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_GET_UPVALUE:
             return byteInstruction("OP_GET_UPVALUE", chunk, offset);
         case OP_SET_UPVALUE:
@@ -128,8 +221,8 @@ int disassembleInstruction(Chunk *chunk, int offset) {
             return simpleInstruction("OP_PRINT", offset);
         case OP_PRINTLN:
             return simpleInstruction("OP_PRINTLN", offset);
-        case OP_TOSTRING:
-            return simpleInstruction("OP_TOSTRING", offset);
+        case OP_BUILD_STRING:
+            return byteInstruction("OP_BUILD_STRING", chunk, offset);
         case OP_JUMP:
             return jumpInstruction("OP_JUMP", 1, chunk, offset);
         case OP_JUMP_IF_FALSE:
@@ -139,23 +232,47 @@ int disassembleInstruction(Chunk *chunk, int offset) {
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
         case OP_CLOSURE:
-            offset++;
-            uint8_t constant = chunk->code[offset++];
-            printf("%-16s %4d ", "OP_CLOSURE", constant);
-            printValue(chunk->constants.values[constant]);
-            printf("\n");
-
-            ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
-            for (int i = 0; i < function->upValueCount; i++) {
-                int isLocal = chunk->code[offset++];
-                int index = chunk->code[offset++];
-                printf("%04d    |                %s %d\n", offset - 2, isLocal ? "local" : "upvalue", index);
-            }
-            return offset;
+            return closureInstruction("OP_CLOSURE", chunk, offset + 1, false);
         case OP_CLOSE_UPVALUE:
             return simpleInstruction("OP_CLOSE_UPVALUE", offset);
         case OP_RETURN:
             return simpleInstruction("OP_RETURN", offset);
+        case OP_WIDE:
+            return wideInstruction(chunk, offset);
+        case OP_POP_JUMP_IF_FALSE:
+            return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_GREATER:
+            return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_LESS:
+            return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+        case OP_JUMP_IF_GREATER:
+            return jumpInstruction("OP_JUMP_IF_GREATER", 1, chunk, offset);
+        case OP_JUMP_IF_LESS:
+            return jumpInstruction("OP_JUMP_IF_LESS", 1, chunk, offset);
+        case OP_ADD_LOCALS:
+            return localsInstruction("OP_ADD_LOCALS", chunk, offset);
+        case OP_SUBTRACT_LOCALS:
+            return localsInstruction("OP_SUBTRACT_LOCALS", chunk, offset);
+        case OP_MULTIPLY_LOCALS:
+            return localsInstruction("OP_MULTIPLY_LOCALS", chunk, offset);
+        case OP_ADD_LOCAL_CONSTANT:
+            return localConstantInstruction("OP_ADD_LOCAL_CONSTANT", chunk, offset);
+        case OP_ADD_NUM:
+            return simpleInstruction("OP_ADD_NUM", offset);
+        case OP_ADD_STR:
+            return simpleInstruction("OP_ADD_STR", offset);
+        case OP_SUBTRACT_NUM:
+            return simpleInstruction("OP_SUBTRACT_NUM", offset);
+        case OP_MULTIPLY_NUM:
+            return simpleInstruction("OP_MULTIPLY_NUM", offset);
+        case OP_DIVIDE_NUM:
+            return simpleInstruction("OP_DIVIDE_NUM", offset);
+        case OP_GREATER_NUM:
+            return simpleInstruction("OP_GREATER_NUM", offset);
+        case OP_LESS_NUM:
+            return simpleInstruction("OP_LESS_NUM", offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
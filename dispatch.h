@@ -0,0 +1,611 @@
+//run() 본체. vm.c가 이 파일을 여러 번 include해서 dispatch loop를 variant별로 따로 컴파일한다:
+//추적 코드가 전혀 없는 run(), --trace로 실행할 때만 쓰는 runTraced(), --stats로 실행한 명령어 수를 세는 runCounted().
+//include하기 전에 RUN_FUNCTION(함수 이름)과 필요하면 TRACE_EXECUTION 또는 COUNT_INSTRUCTIONS를 정의해야 한다. (include guard 없음)
+
+static InterpretResult RUN_FUNCTION() {
+    //dispatch loop에서 매번 메모리를 거치지 않도록 ip, stackTop, slots, 상수 배열을 지역 변수(레지스터)에 캐시한다.
+    //call, return, error, 할당이 일어나는 지점에서만 frame->ip와 vm.stackTop에 다시 기록한다.
+    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+    register uint8_t *ip = frame->ip;
+    register Value *sp = vm.stackTop;
+    register Value *slots = frame->slots;
+    register Value *constants = frame->closure->function->chunk.constants.values;
+
+#define READ_BYTE() (*ip++) //bytecode dispatch
+#define READ_CONSTANT() (constants[READ_BYTE()])
+#define READ_SHORT() \
+    (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_WORD() \
+    (ip += 4, (uint32_t) ip[-4] << 24 | (uint32_t) ip[-3] << 16 | (uint32_t) (ip[-2] << 8) | ip[-1])
+#define READ_CONSTANT_LONG() \
+    (ip += 3, constants[(ip[-3] << 16) | (ip[-2] << 8) | ip[-1]])
+#define READ_STRING() AS_STRING(READ_CONSTANT())
+#define GLOBAL_VAR(slot) READ_AS(GlobalVar, &vm.globals.vars, slot)
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define PEEK(distance) (sp[-1 - (distance)])
+#define STORE_FRAME() (frame->ip = ip, vm.stackTop = sp)
+#define LOAD_FRAME() \
+    (frame = &vm.frames[vm.frameCount - 1], \
+     ip = frame->ip, \
+     slots = frame->slots, \
+     constants = frame->closure->function->chunk.constants.values, \
+     sp = vm.stackTop)
+#define RUNTIME_ERROR(...) \
+    do { \
+        STORE_FRAME(); \
+        runtimeError(__VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+#define BINARY_OP(valueType, op, quickened) \
+    do{\
+        if(!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        }             \
+        ip[-1] = quickened; /*숫자 피연산자를 관찰했으므로 특수화된 명령어로 바꿔 쓴다*/ \
+        double b = AS_NUMBER(POP());                     \
+        double a = AS_NUMBER(POP());                     \
+        PUSH(valueType(a op b));\
+        }while (false)
+//특수화된 명령어: 가드는 한 번뿐이고, 예상과 다른 타입이 오면 제네릭 명령어로 되돌린 뒤 다시 실행한다 (에러 보고도 제네릭이 담당)
+#define BINARY_OP_NUM(valueType, op, generic) \
+    if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) { \
+        double b = AS_NUMBER(POP()); \
+        PEEK(0) = valueType(AS_NUMBER(PEEK(0)) op b); \
+    } else { \
+        ip[-1] = generic; \
+        ip--; \
+    }
+//비교 후 분기하는 superinstruction: 두 피연산자를 pop하고 cond가 참이면 점프한다
+#define COMPARE_JUMP(readOffset, cond) \
+    do { \
+        uint32_t offset = readOffset; \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        } \
+        double b = AS_NUMBER(POP()); \
+        double a = AS_NUMBER(POP()); \
+        if (cond) ip += offset; \
+    } while (false)
+//rope는 내용이 같아도 객체가 다르므로 동등 비교 전에 flatten해서 평범한 문자열로 바꿔둔다 (valuesEqual은 문자열만 다룬다).
+//스택 위에서 바꿔 쓰므로 flatten 중에 GC가 돌아도 안전하고, 다음 비교부터는 캐시된 문자열을 쓴다
+#define FLATTEN_OPERAND(distance) \
+    do { \
+        if (IS_ROPE(PEEK(distance))) { \
+            STORE_FRAME(); \
+            PEEK(distance) = OBJ_VAL(flattenRope(AS_ROPE(PEEK(distance)))); \
+        } \
+    } while (false)
+#define EQUAL_JUMP(readOffset) \
+    do { \
+        uint32_t offset = readOffset; \
+        FLATTEN_OPERAND(0); \
+        FLATTEN_OPERAND(1); \
+        Value b = POP(); \
+        Value a = POP(); \
+        if (!valuesEqual(a, b)) ip += offset; \
+    } while (false)
+//피연산자를 읽는 방법(readOperand)만 다른 좁은/wide 명령어가 같은 본문을 쓴다
+#define CALL_OP(readOperand) \
+    do { \
+        int argCount = readOperand; \
+        STORE_FRAME(); \
+        if (!callValue(PEEK(argCount), argCount)) { \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        LOAD_FRAME(); \
+    } while (false)
+#define CLOSURE_OP(readOperand) \
+    do { \
+        ObjFunction *function = AS_FUNCTION(constants[readOperand]); \
+        STORE_FRAME(); \
+        ObjClosure *closure = newClosure(function); \
+        PUSH(OBJ_VAL(closure)); \
+        vm.stackTop = sp; \
+        for (int i = 0; i < closure->upValueCount; i++) { \
+            uint8_t isLocal = READ_BYTE(); \
+            uint16_t index = readOperand; \
+            if (isLocal) { \
+                closure->upValues[i] = captureUpValue(slots + index); \
+            } else { \
+                closure->upValues[i] = frame->closure->upValues[index]; \
+            } \
+        } \
+    } while (false)
+//지역 변수 슬롯 두 개를 직접 읽는 산술 superinstruction (OP_GET_LOCAL 두 번 + 연산)
+#define LOCALS_OP(op) \
+    do { \
+        Value a = slots[READ_BYTE()]; \
+        Value b = slots[READ_BYTE()]; \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) { \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        } \
+        PUSH(NUMBER_VAL(AS_NUMBER(a) op AS_NUMBER(b))); \
+    } while (false)
+
+#ifdef TRACE_EXECUTION //vm이 명령어를 실행하기 직전에 스택과 디스어셈블한 결과를 매번 동적으로 출력
+#define TRACE_INSTRUCTION() \
+    do { \
+        printf("          "); \
+        for (Value *slot = vm.stack; slot < sp; slot++) { \
+            printf("[ "); \
+            printValue(stdout, *slot); \
+            printf(" ]"); \
+        } \
+        printf("\n"); \
+        disassembleInstruction(&frame->closure->function->chunk, \
+                               (int) (ip - frame->closure->function->chunk.code)); \
+    } while (false)
+#elif defined(COUNT_INSTRUCTIONS) //dispatch된 명령어 수만 센다 (벤치마크용)
+#define TRACE_INSTRUCTION() (vm.instructionCount++)
+#else
+#define TRACE_INSTRUCTION() do {} while (false)
+#endif
+
+#ifdef COMPUTED_GOTO
+    //labels-as-values(GCC/Clang 확장): 각 핸들러가 switch로 돌아가지 않고 다음 핸들러로 바로 점프한다
+    static void *dispatchTable[] = {
+        [OP_CONSTANT] = &&op_OP_CONSTANT,
+        [OP_CONSTANT_LONG] = &&op_OP_CONSTANT_LONG,
+        [OP_SMALL_INT] = &&op_OP_SMALL_INT,
+        [OP_NIL] = &&op_OP_NIL,
+        [OP_TRUE] = &&op_OP_TRUE,
+        [OP_FALSE] = &&op_OP_FALSE,
+        [OP_POP] = &&op_OP_POP,
+        [OP_EQUAL_PRESERVE] = &&op_OP_EQUAL_PRESERVE,
+        [OP_GET_LOCAL] = &&op_OP_GET_LOCAL,
+        [OP_SET_LOCAL] = &&op_OP_SET_LOCAL,
+        [OP_GET_GLOBAL] = &&op_OP_GET_GLOBAL,
+        [OP_GET_UPVALUE] = &&op_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE] = &&op_OP_SET_UPVALUE,
+        [OP_DEFINE_CONST_GLOBAL] = &&op_OP_DEFINE_CONST_GLOBAL,
+        [OP_DEFINE_LET_GLOBAL] = &&op_OP_DEFINE_LET_GLOBAL,
+        [OP_SET_GLOBAL] = &&op_OP_SET_GLOBAL,
+        [OP_EQUAL] = &&op_OP_EQUAL,
+        [OP_GREATER] = &&op_OP_GREATER,
+        [OP_LESS] = &&op_OP_LESS,
+        [OP_ADD] = &&op_OP_ADD,
+        [OP_SUBTRACT] = &&op_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&op_OP_MULTIPLY,
+        [OP_DIVIDE] = &&op_OP_DIVIDE,
+        [OP_MODULO] = &&op_OP_MODULO,
+        [OP_NOT] = &&op_OP_NOT,
+        [OP_NEGATIVE] = &&op_OP_NEGATIVE,
+        [OP_BUILD_STRING] = &&op_OP_BUILD_STRING,
+        [OP_PRINT] = &&op_OP_PRINT,
+        [OP_PRINTLN] = &&op_OP_PRINTLN,
+        [OP_JUMP] = &&op_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&op_OP_JUMP_IF_FALSE,
+        [OP_LOOP] = &&op_OP_LOOP,
+        [OP_CALL] = &&op_OP_CALL,
+        [OP_CLOSURE] = &&op_OP_CLOSURE,
+        [OP_CLOSE_UPVALUE] = &&op_OP_CLOSE_UPVALUE,
+        [OP_RETURN] = &&op_OP_RETURN,
+        [OP_WIDE] = &&op_OP_WIDE,
+        [OP_POP_JUMP_IF_FALSE] = &&op_OP_POP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_NOT_EQUAL] = &&op_OP_JUMP_IF_NOT_EQUAL,
+        [OP_JUMP_IF_NOT_GREATER] = &&op_OP_JUMP_IF_NOT_GREATER,
+        [OP_JUMP_IF_NOT_LESS] = &&op_OP_JUMP_IF_NOT_LESS,
+        [OP_JUMP_IF_GREATER] = &&op_OP_JUMP_IF_GREATER,
+        [OP_JUMP_IF_LESS] = &&op_OP_JUMP_IF_LESS,
+        [OP_ADD_LOCALS] = &&op_OP_ADD_LOCALS,
+        [OP_SUBTRACT_LOCALS] = &&op_OP_SUBTRACT_LOCALS,
+        [OP_MULTIPLY_LOCALS] = &&op_OP_MULTIPLY_LOCALS,
+        [OP_ADD_LOCAL_CONSTANT] = &&op_OP_ADD_LOCAL_CONSTANT,
+        [OP_ADD_NUM] = &&op_OP_ADD_NUM,
+        [OP_ADD_STR] = &&op_OP_ADD_STR,
+        [OP_SUBTRACT_NUM] = &&op_OP_SUBTRACT_NUM,
+        [OP_MULTIPLY_NUM] = &&op_OP_MULTIPLY_NUM,
+        [OP_DIVIDE_NUM] = &&op_OP_DIVIDE_NUM,
+        [OP_GREATER_NUM] = &&op_OP_GREATER_NUM,
+        [OP_LESS_NUM] = &&op_OP_LESS_NUM,
+    };
+#define CASE(op) op_##op
+#define DISPATCH() \
+    do { \
+        TRACE_INSTRUCTION(); \
+        goto *dispatchTable[READ_BYTE()]; \
+    } while (false)
+
+    DISPATCH();
+#else
+#define CASE(op) case op
+#define DISPATCH() continue
+
+    for (;;) {
+        TRACE_INSTRUCTION();
+        switch (READ_BYTE()) {
+#endif
+            CASE(OP_CONSTANT): {
+                PUSH(READ_CONSTANT());
+                DISPATCH();
+            }
+            CASE(OP_CONSTANT_LONG): {
+                PUSH(READ_CONSTANT_LONG());
+                DISPATCH();
+            }
+            CASE(OP_SMALL_INT):
+                PUSH(NUMBER_VAL(READ_BYTE()));
+                DISPATCH();
+            CASE(OP_NIL):
+                PUSH(NIL_VAL);
+                DISPATCH();
+            CASE(OP_TRUE):
+                PUSH(BOOL_VAL(true));
+                DISPATCH();
+            CASE(OP_FALSE):
+                PUSH(BOOL_VAL(false));
+                DISPATCH();
+            CASE(OP_POP):
+                sp--;
+                DISPATCH();
+            CASE(OP_GET_LOCAL): {
+                uint8_t slot = READ_BYTE();
+                PUSH(slots[slot]);
+                DISPATCH();
+            }
+            CASE(OP_SET_LOCAL): {
+                uint8_t slot = READ_BYTE();
+                //할당은 표현식이고 모든 표현식은 값을 만들어낸다. 할당식의 값은 할당된 값 그 자체이므로 pop()은 하지 않는다
+                slots[slot] = PEEK(0);
+                DISPATCH();
+            }
+            CASE(OP_GET_GLOBAL): {
+                uint16_t slot = READ_SHORT();
+                Value value = vm.globals.values.values[slot];
+                if (IS_UNDEFINED(value)) {
+                    RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_VAR(slot).name->chars);
+                }
+                PUSH(value);
+                DISPATCH();
+            }
+            CASE(OP_DEFINE_CONST_GLOBAL): {
+                //슬롯이 이미 정의된 경우 에러
+                uint16_t slot = READ_SHORT();
+                if (!IS_UNDEFINED(vm.globals.values.values[slot])) {
+                    RUNTIME_ERROR("Variable '%s' already defined.", GLOBAL_VAR(slot).name->chars);
+                }
+                vm.globals.values.values[slot] = POP();
+                GLOBAL_VAR(slot).isConst = true;
+                DISPATCH();
+            }
+            CASE(OP_DEFINE_LET_GLOBAL): {
+                uint16_t slot = READ_SHORT();
+                if (!IS_UNDEFINED(vm.globals.values.values[slot])) {
+                    RUNTIME_ERROR("Variable '%s' already defined.", GLOBAL_VAR(slot).name->chars);
+                }
+                vm.globals.values.values[slot] = POP();
+                DISPATCH();
+            }
+            CASE(OP_SET_GLOBAL): {
+                //변수를 set 해도 스택에서 값을 pop()하지 않는다. 할당은 표현식이다
+                uint16_t slot = READ_SHORT();
+                if (GLOBAL_VAR(slot).isConst) {
+                    RUNTIME_ERROR("Can't assign to constant variable '%s'.", GLOBAL_VAR(slot).name->chars);
+                }
+                Value *value = &vm.globals.values.values[slot];
+                if (IS_UNDEFINED(*value)) {
+                    RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_VAR(slot).name->chars);
+                }
+                *value = PEEK(0);
+                DISPATCH();
+            }
+            CASE(OP_GET_UPVALUE): {
+                uint8_t slot = READ_BYTE();
+                PUSH(*frame->closure->upValues[slot]->location);
+                DISPATCH();
+            }
+            CASE(OP_SET_UPVALUE): {
+                uint8_t slot = READ_BYTE();
+                *frame->closure->upValues[slot]->location = PEEK(0);
+                DISPATCH();
+            }
+            CASE(OP_EQUAL): {
+                FLATTEN_OPERAND(0);
+                FLATTEN_OPERAND(1);
+                Value b = POP();
+                Value a = POP();
+                PUSH(BOOL_VAL(valuesEqual(a, b)));
+                DISPATCH();
+            }
+            CASE(OP_EQUAL_PRESERVE): {
+                FLATTEN_OPERAND(0);
+                FLATTEN_OPERAND(1);
+                Value b = POP();
+                Value a = PEEK(0);
+                PUSH(BOOL_VAL(valuesEqual(a, b)));
+                DISPATCH();
+            }
+            CASE(OP_GREATER):
+                BINARY_OP(BOOL_VAL, >, OP_GREATER_NUM);
+                DISPATCH();
+            CASE(OP_LESS):
+                BINARY_OP(BOOL_VAL, <, OP_LESS_NUM);
+                DISPATCH();
+            CASE(OP_ADD): {
+                if (IS_TEXT(PEEK(0)) && IS_TEXT(PEEK(1))) {
+                    ip[-1] = OP_ADD_STR;
+                    STORE_FRAME();
+                    concatenate();
+                    sp = vm.stackTop;
+                } else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+                    ip[-1] = OP_ADD_NUM;
+                    double b = AS_NUMBER(POP());
+                    double a = AS_NUMBER(POP());
+                    PUSH(NUMBER_VAL(a + b));
+                } else {
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                }
+                DISPATCH();
+            }
+            CASE(OP_SUBTRACT):
+                BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT_NUM);
+                DISPATCH();
+            CASE(OP_MULTIPLY):
+                BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM);
+                DISPATCH();
+            CASE(OP_DIVIDE):
+                BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUM);
+                DISPATCH();
+            CASE(OP_ADD_NUM):
+                BINARY_OP_NUM(NUMBER_VAL, +, OP_ADD);
+                DISPATCH();
+            CASE(OP_ADD_STR):
+                if (IS_TEXT(PEEK(0)) && IS_TEXT(PEEK(1))) {
+                    STORE_FRAME();
+                    concatenate();
+                    sp = vm.stackTop;
+                } else {
+                    ip[-1] = OP_ADD;
+                    ip--;
+                }
+                DISPATCH();
+            CASE(OP_SUBTRACT_NUM):
+                BINARY_OP_NUM(NUMBER_VAL, -, OP_SUBTRACT);
+                DISPATCH();
+            CASE(OP_MULTIPLY_NUM):
+                BINARY_OP_NUM(NUMBER_VAL, *, OP_MULTIPLY);
+                DISPATCH();
+            CASE(OP_DIVIDE_NUM):
+                BINARY_OP_NUM(NUMBER_VAL, /, OP_DIVIDE);
+                DISPATCH();
+            CASE(OP_GREATER_NUM):
+                BINARY_OP_NUM(BOOL_VAL, >, OP_GREATER);
+                DISPATCH();
+            CASE(OP_LESS_NUM):
+                BINARY_OP_NUM(BOOL_VAL, <, OP_LESS);
+                DISPATCH();
+            CASE(OP_MODULO): {
+                if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {
+                    RUNTIME_ERROR("Operand must be a number");
+                }
+                double b = AS_NUMBER(POP());
+                double a = AS_NUMBER(POP());
+                PUSH(NUMBER_VAL(fmod(a, b)));
+                DISPATCH();
+            }
+            CASE(OP_NOT):
+                PEEK(0) = BOOL_VAL(isFalsey(PEEK(0)));
+                DISPATCH();
+            CASE(OP_NEGATIVE):
+                if (!IS_NUMBER(PEEK(0))) {
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+                PEEK(0) = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
+                DISPATCH();
+            CASE(OP_PRINT):
+                printValue(vm.out, POP());
+                DISPATCH();
+            CASE(OP_PRINTLN):
+                printValue(vm.out, POP());
+                fputc('\n', vm.out);
+                DISPATCH();
+            CASE(OP_BUILD_STRING): {
+                int count = READ_BYTE();
+                STORE_FRAME();
+                buildString(count);
+                sp = vm.stackTop;
+                DISPATCH();
+            }
+            CASE(OP_JUMP): {
+                uint16_t offset = READ_SHORT();
+                ip += offset;
+                DISPATCH();
+            }
+            CASE(OP_JUMP_IF_FALSE): {
+                uint16_t offset = READ_SHORT();
+                if (isFalsey(PEEK(0))) ip += offset;
+                DISPATCH();
+            }
+            CASE(OP_LOOP): {
+                uint16_t offset = READ_SHORT();
+                ip -= offset;
+                DISPATCH();
+            }
+            CASE(OP_POP_JUMP_IF_FALSE): {
+                uint16_t offset = READ_SHORT();
+                if (isFalsey(POP())) ip += offset;
+                DISPATCH();
+            }
+            CASE(OP_JUMP_IF_NOT_EQUAL):
+                EQUAL_JUMP(READ_SHORT());
+                DISPATCH();
+            CASE(OP_JUMP_IF_NOT_GREATER):
+                COMPARE_JUMP(READ_SHORT(), !(a > b));
+                DISPATCH();
+            CASE(OP_JUMP_IF_NOT_LESS):
+                COMPARE_JUMP(READ_SHORT(), !(a < b));
+                DISPATCH();
+            CASE(OP_JUMP_IF_GREATER):
+                COMPARE_JUMP(READ_SHORT(), a > b);
+                DISPATCH();
+            CASE(OP_JUMP_IF_LESS):
+                COMPARE_JUMP(READ_SHORT(), a < b);
+                DISPATCH();
+            CASE(OP_ADD_LOCALS): {
+                Value a = slots[READ_BYTE()];
+                Value b = slots[READ_BYTE()];
+                if (IS_NUMBER(a) && IS_NUMBER(b)) {
+                    PUSH(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+                } else if (IS_TEXT(a) && IS_TEXT(b)) {
+                    PUSH(a);
+                    PUSH(b);
+                    STORE_FRAME();
+                    concatenate();
+                    sp = vm.stackTop;
+                } else {
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                }
+                DISPATCH();
+            }
+            CASE(OP_SUBTRACT_LOCALS):
+                LOCALS_OP(-);
+                DISPATCH();
+            CASE(OP_MULTIPLY_LOCALS):
+                LOCALS_OP(*);
+                DISPATCH();
+            CASE(OP_ADD_LOCAL_CONSTANT): {
+                //할당식이므로 갱신된 값을 스택에도 남긴다
+                Value *local = &slots[READ_BYTE()];
+                Value constant = READ_CONSTANT();
+                if (IS_NUMBER(*local) && IS_NUMBER(constant)) {
+                    *local = NUMBER_VAL(AS_NUMBER(*local) + AS_NUMBER(constant));
+                } else if (IS_TEXT(*local) && IS_TEXT(constant)) {
+                    PUSH(*local);
+                    PUSH(constant);
+                    STORE_FRAME();
+                    concatenate();
+                    sp = vm.stackTop;
+                    *local = POP();
+                } else {
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                }
+                PUSH(*local);
+                DISPATCH();
+            }
+            CASE(OP_CALL):
+                CALL_OP(READ_BYTE());
+                DISPATCH();
+            CASE(OP_CLOSURE):
+                CLOSURE_OP(READ_BYTE());
+                DISPATCH();
+            CASE(OP_CLOSE_UPVALUE):
+                closeUpValues(sp - 1);
+                sp--;
+                DISPATCH();
+            CASE(OP_RETURN): {
+                Value result = POP();
+                closeUpValues(slots);
+                vm.frameCount--;
+                if (vm.frameCount == 0) {
+                    if (vm.fiber != NULL) {
+                        //fiber의 함수가 끝났다: resume한 쪽으로 돌아가서 이어서 실행한다
+                        finishFiber(result);
+                        LOAD_FRAME();
+                        DISPATCH();
+                    }
+                    sp--;
+                    vm.stackTop = sp;
+                    return INTERPRET_OK;
+                }
+                sp = slots;
+                PUSH(result);
+                vm.stackTop = sp;
+                LOAD_FRAME();
+                DISPATCH();
+            }
+            CASE(OP_WIDE): {
+                //느린 경로: 뒤따르는 명령어를 2배 너비의 피연산자로 실행한다. 좁은 명령어의 핸들러는 그대로이므로
+                //평소 경로에는 비용이 없다. 합친 명령어(superinstruction)와 quickening 대상은 wide 형태가 없다
+                switch (READ_BYTE()) {
+                    case OP_GET_LOCAL:
+                        PUSH(slots[READ_SHORT()]);
+                        break;
+                    case OP_SET_LOCAL:
+                        slots[READ_SHORT()] = PEEK(0);
+                        break;
+                    case OP_GET_UPVALUE:
+                        PUSH(*frame->closure->upValues[READ_SHORT()]->location);
+                        break;
+                    case OP_SET_UPVALUE:
+                        *frame->closure->upValues[READ_SHORT()]->location = PEEK(0);
+                        break;
+                    case OP_CALL:
+                        CALL_OP(READ_SHORT());
+                        break;
+                    case OP_CLOSURE:
+                        CLOSURE_OP(READ_SHORT());
+                        break;
+                    case OP_JUMP: {
+                        uint32_t offset = READ_WORD();
+                        ip += offset;
+                        break;
+                    }
+                    case OP_JUMP_IF_FALSE: {
+                        uint32_t offset = READ_WORD();
+                        if (isFalsey(PEEK(0))) ip += offset;
+                        break;
+                    }
+                    case OP_LOOP: {
+                        uint32_t offset = READ_WORD();
+                        ip -= offset;
+                        break;
+                    }
+                    case OP_POP_JUMP_IF_FALSE: {
+                        uint32_t offset = READ_WORD();
+                        if (isFalsey(POP())) ip += offset;
+                        break;
+                    }
+                    case OP_JUMP_IF_NOT_EQUAL:
+                        EQUAL_JUMP(READ_WORD());
+                        break;
+                    case OP_JUMP_IF_NOT_GREATER:
+                        COMPARE_JUMP(READ_WORD(), !(a > b));
+                        break;
+                    case OP_JUMP_IF_NOT_LESS:
+                        COMPARE_JUMP(READ_WORD(), !(a < b));
+                        break;
+                    case OP_JUMP_IF_GREATER:
+                        COMPARE_JUMP(READ_WORD(), a > b);
+                        break;
+                    case OP_JUMP_IF_LESS:
+                        COMPARE_JUMP(READ_WORD(), a < b);
+                        break;
+                    default:
+                        RUNTIME_ERROR("Invalid wide instruction.");
+                }
+                DISPATCH();
+            }
+#ifndef COMPUTED_GOTO
+        }
+    }
+#endif
+#undef READ_BYTE
+#undef READ_CONSTANT
+#undef READ_SHORT
+#undef READ_WORD
+#undef READ_CONSTANT_LONG
+#undef READ_STRING
+#undef GLOBAL_VAR
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef STORE_FRAME
+#undef LOAD_FRAME
+#undef RUNTIME_ERROR
+#undef BINARY_OP
+#undef BINARY_OP_NUM
+#undef COMPARE_JUMP
+#undef EQUAL_JUMP
+#undef CALL_OP
+#undef CLOSURE_OP
+#undef FLATTEN_OPERAND
+#undef LOCALS_OP
+#undef TRACE_INSTRUCTION
+#undef CASE
+#undef DISPATCH
+}
+
+#undef RUN_FUNCTION
+#undef TRACE_EXECUTION
+#undef COUNT_INSTRUCTIONS
@@ -0,0 +1,316 @@
+//Grisu2 기반 double -> 문자열 변환 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers").
+//printf("%g")와 달리 locale/format 문자열을 해석하지 않고, 다시 읽었을 때 같은 double이 되는 짧은 자릿수를 출력한다.
+//정수 값은 Grisu를 거치지 않고 두 자리씩 바로 쓴다
+#include <math.h>
+#include <string.h>
+
+#include "dtoa.h"
+
+#define SIGNIFICAND_SIZE 52
+#define EXPONENT_BIAS (0x3FF + SIGNIFICAND_SIZE)
+#define MIN_EXPONENT (-EXPONENT_BIAS)
+#define HIDDEN_BIT 0x0010000000000000u
+#define SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFu
+#define EXPONENT_MASK 0x7FF0000000000000u
+#define MAX_EXACT_INTEGER 9007199254740992.0 //2^53: 이 범위의 정수는 double로 정확히 표현된다
+
+typedef struct {
+    //f * 2^e (do-it-yourself floating point)
+    uint64_t f;
+    int e;
+} DiyFp;
+
+static const char digitPairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+static const uint64_t pow10Table[] = {
+        1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u, 10000000u, 100000000u, 1000000000u,
+        10000000000u, 100000000000u, 1000000000000u, 10000000000000u, 100000000000000u,
+        1000000000000000u, 10000000000000000u, 100000000000000000u, 1000000000000000000u,
+        10000000000000000000u
+};
+
+//10^-348 ~ 10^340 (8 간격)의 정규화된 근사값: 10^k ~= cachedPowerF[i] * 2^cachedPowerE[i], k = -348 + 8i
+static const uint64_t cachedPowerF[] = {
+        0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76,
+        0xcf42894a5dce35ea, 0x9a6bb0aa55653b2d, 0xe61acf033d1a45df,
+        0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f, 0xbe5691ef416bd60c,
+        0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+        0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57,
+        0xc21094364dfb5637, 0x9096ea6f3848984f, 0xd77485cb25823ac7,
+        0xa086cfcd97bf97f4, 0xef340a98172aace5, 0xb23867fb2a35b28e,
+        0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+        0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126,
+        0xb5b5ada8aaff80b8, 0x87625f056c7c4a8b, 0xc9bcff6034c13053,
+        0x964e858c91ba2655, 0xdff9772470297ebd, 0xa6dfbd9fb8e5b88f,
+        0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+        0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06,
+        0xaa242499697392d3, 0xfd87b5f28300ca0e, 0xbce5086492111aeb,
+        0x8cbccc096f5088cc, 0xd1b71758e219652c, 0x9c40000000000000,
+        0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+        0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068,
+        0x9f4f2726179a2245, 0xed63a231d4c4fb27, 0xb0de65388cc8ada8,
+        0x83c7088e1aab65db, 0xc45d1df942711d9a, 0x924d692ca61be758,
+        0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+        0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d,
+        0x952ab45cfa97a0b3, 0xde469fbd99a05fe3, 0xa59bc234db398c25,
+        0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece, 0x88fcf317f22241e2,
+        0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+        0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410,
+        0x8bab8eefb6409c1a, 0xd01fef10a657842c, 0x9b10a4e5e9913129,
+        0xe7109bfba19c0c9d, 0xac2820d9623bf429, 0x80444b5e7aa7cf85,
+        0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+        0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b
+};
+
+static const int16_t cachedPowerE[] = {
+        -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+        -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+        -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+        -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+        -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+        109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+        375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+        641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+        907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static DiyFp diyFromDouble(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biasedExponent = (int) ((bits & EXPONENT_MASK) >> SIGNIFICAND_SIZE);
+    uint64_t significand = bits & SIGNIFICAND_MASK;
+    if (biasedExponent != 0) {
+        return (DiyFp) {significand + HIDDEN_BIT, biasedExponent - EXPONENT_BIAS};
+    }
+    return (DiyFp) {significand, MIN_EXPONENT + 1}; //비정규 수
+}
+
+static DiyFp diyMultiply(DiyFp x, DiyFp y) {
+    //128비트 곱의 상위 64비트 (반올림)
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 product = (unsigned __int128) x.f * y.f;
+    uint64_t high = (uint64_t) (product >> 64);
+    if ((uint64_t) product & (1ull << 63)) high++;
+    return (DiyFp) {high, x.e + y.e + 64};
+#else
+    const uint64_t mask32 = 0xFFFFFFFFu;
+    uint64_t a = x.f >> 32, b = x.f & mask32, c = y.f >> 32, d = y.f & mask32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t middle = (bd >> 32) + (ad & mask32) + (bc & mask32);
+    middle += 1u << 31;
+    return (DiyFp) {ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64};
+#endif
+}
+
+static DiyFp diyNormalize(DiyFp value) {
+    int shift = __builtin_clzll(value.f);
+    return (DiyFp) {value.f << shift, value.e - shift};
+}
+
+static void normalizedBoundaries(DiyFp value, DiyFp *minus, DiyFp *plus) {
+    //value와 이웃한 두 double과의 중간점 m-, m+ (이 구간 안의 수는 모두 value로 읽힌다)
+    DiyFp upper = {(value.f << 1) + 1, value.e - 1};
+    while (!(upper.f & (HIDDEN_BIT << 1))) {
+        upper.f <<= 1;
+        upper.e--;
+    }
+    upper.f <<= 64 - SIGNIFICAND_SIZE - 2;
+    upper.e -= 64 - SIGNIFICAND_SIZE - 2;
+
+    //2의 거듭제곱이면 아래쪽 간격이 절반이다
+    DiyFp lower = value.f == HIDDEN_BIT ? (DiyFp) {(value.f << 2) - 1, value.e - 2}
+                                        : (DiyFp) {(value.f << 1) - 1, value.e - 1};
+    lower.f <<= lower.e - upper.e;
+    lower.e = upper.e;
+    *minus = lower;
+    *plus = upper;
+}
+
+static DiyFp cachedPower(int e, int *decimalExponent) {
+    //곱한 결과의 이진 지수가 [-60, -32] 범위에 들도록 10^-k를 고른다
+    double dk = (-61 - e) * 0.30102999566398114 + 347; //log10(2)
+    int k = (int) dk;
+    if (dk - k > 0.0) k++;
+    unsigned index = (unsigned) ((k >> 3) + 1);
+    *decimalExponent = -(-348 + (int) (index << 3));
+    return (DiyFp) {cachedPowerF[index], cachedPowerE[index]};
+}
+
+static int countDecimalDigits(uint32_t n) {
+    if (n < 10) return 1;
+    if (n < 100) return 2;
+    if (n < 1000) return 3;
+    if (n < 10000) return 4;
+    if (n < 100000) return 5;
+    if (n < 1000000) return 6;
+    if (n < 10000000) return 7;
+    if (n < 100000000) return 8;
+    return n < 1000000000 ? 9 : 10;
+}
+
+static void grisuRound(char *buffer, int length, uint64_t delta, uint64_t rest, uint64_t tenKappa,
+                       uint64_t distance) {
+    //마지막 자릿수를 실제 값에 더 가까운 쪽으로 내린다
+    while (rest < distance && delta - rest >= tenKappa &&
+           (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance)) {
+        buffer[length - 1]--;
+        rest += tenKappa;
+    }
+}
+
+static int digitGen(DiyFp w, DiyFp upper, uint64_t delta, char *buffer, int *decimalExponent) {
+    //[upper - delta, upper] 구간 안에서 가장 짧은 자릿수열을 만든다. 반환값은 자릿수
+    DiyFp one = {1ull << -upper.e, upper.e};
+    uint64_t distance = upper.f - w.f;
+    uint32_t integral = (uint32_t) (upper.f >> -one.e);
+    uint64_t fraction = upper.f & (one.f - 1);
+    int kappa = countDecimalDigits(integral);
+    int length = 0;
+
+    while (kappa > 0) {
+        uint32_t divisor = (uint32_t) pow10Table[kappa - 1];
+        uint32_t digit = integral / divisor;
+        integral %= divisor;
+        if (digit != 0 || length != 0) buffer[length++] = (char) ('0' + digit);
+        kappa--;
+        uint64_t rest = ((uint64_t) integral << -one.e) + fraction;
+        if (rest <= delta) {
+            *decimalExponent += kappa;
+            grisuRound(buffer, length, delta, rest, pow10Table[kappa] << -one.e, distance);
+            return length;
+        }
+    }
+
+    for (;;) {
+        fraction *= 10;
+        delta *= 10;
+        char digit = (char) (fraction >> -one.e);
+        if (digit != 0 || length != 0) buffer[length++] = (char) ('0' + digit);
+        fraction &= one.f - 1;
+        kappa--;
+        if (fraction < delta) {
+            *decimalExponent += kappa;
+            int index = -kappa;
+            grisuRound(buffer, length, delta, fraction, one.f, distance * (index < 20 ? pow10Table[index] : 0));
+            return length;
+        }
+    }
+}
+
+static int grisu2(double value, char *buffer, int *decimalExponent) {
+    //value(> 0)의 자릿수를 buffer에 쓴다: value ~= digits * 10^decimalExponent
+    DiyFp v = diyFromDouble(value);
+    DiyFp minus, plus;
+    normalizedBoundaries(v, &minus, &plus);
+
+    DiyFp scale = cachedPower(plus.e, decimalExponent);
+    DiyFp w = diyMultiply(diyNormalize(v), scale);
+    DiyFp upper = diyMultiply(plus, scale);
+    DiyFp lower = diyMultiply(minus, scale);
+    upper.f--; //곱셈 오차만큼 구간을 안쪽으로 좁혀서 항상 원래 값으로 다시 읽히는 자릿수만 고른다
+    lower.f++;
+    return digitGen(w, upper, upper.f - lower.f, buffer, decimalExponent);
+}
+
+static int writeExponent(int exponent, char *buffer) {
+    //JavaScript처럼 "e+21", "e-7" (0 채움 없음)
+    char *start = buffer;
+    *buffer++ = 'e';
+    *buffer++ = exponent < 0 ? '-' : '+';
+    if (exponent < 0) exponent = -exponent;
+    if (exponent >= 100) {
+        *buffer++ = (char) ('0' + exponent / 100);
+        exponent %= 100;
+        memcpy(buffer, &digitPairs[exponent * 2], 2);
+        buffer += 2;
+    } else if (exponent >= 10) {
+        memcpy(buffer, &digitPairs[exponent * 2], 2);
+        buffer += 2;
+    } else {
+        *buffer++ = (char) ('0' + exponent);
+    }
+    return (int) (buffer - start);
+}
+
+static int prettify(char *buffer, int length, int decimalExponent) {
+    //digits * 10^decimalExponent를 읽기 쉬운 표기로 바꾼다. 10^21 미만은 지수 없이, 10^-6 미만은 지수 표기
+    int point = length + decimalExponent; //10^(point-1) <= value < 10^point
+    if (decimalExponent >= 0 && point <= 21) {
+        //1234e3 -> 1234000
+        memset(buffer + length, '0', decimalExponent);
+        return point;
+    }
+    if (point > 0 && point <= 21) {
+        //1234e-2 -> 12.34
+        memmove(buffer + point + 1, buffer + point, length - point);
+        buffer[point] = '.';
+        return length + 1;
+    }
+    if (point > -6 && point <= 0) {
+        //1234e-6 -> 0.001234
+        int offset = 2 - point;
+        memmove(buffer + offset, buffer, length);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        memset(buffer + 2, '0', offset - 2);
+        return length + offset;
+    }
+    if (length == 1) {
+        //1e30 -> 1e+30
+        return 1 + writeExponent(point - 1, buffer + 1);
+    }
+    //1234e30 -> 1.234e+33
+    memmove(buffer + 2, buffer + 1, length - 1);
+    buffer[1] = '.';
+    return length + 1 + writeExponent(point - 1, buffer + length + 1);
+}
+
+static int formatInteger(uint64_t value, char *buffer) {
+    //오른쪽부터 두 자리씩 채운 뒤 앞으로 옮긴다
+    char digits[20];
+    char *end = digits + sizeof(digits);
+    char *p = end;
+    while (value >= 100) {
+        p -= 2;
+        memcpy(p, &digitPairs[(value % 100) * 2], 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, &digitPairs[value * 2], 2);
+    } else {
+        *--p = (char) ('0' + value);
+    }
+    int length = (int) (end - p);
+    memcpy(buffer, p, length);
+    return length;
+}
+
+int formatNumber(double number, char *buffer) {
+    char *start = buffer;
+    if (isnan(number)) {
+        memcpy(buffer, "nan", 4);
+        return 3;
+    }
+    if (signbit(number)) {
+        *buffer++ = '-';
+        number = -number;
+    }
+
+    int length;
+    if (isinf(number)) {
+        memcpy(buffer, "inf", 3);
+        length = 3;
+    } else if (number <= MAX_EXACT_INTEGER && number == (double) (uint64_t) number) {
+        length = formatInteger((uint64_t) number, buffer); //정수 fast path (0 포함)
+    } else {
+        int decimalExponent;
+        length = grisu2(number, buffer, &decimalExponent);
+        length = prettify(buffer, length, decimalExponent);
+    }
+    buffer[length] = '\0';
+    return (int) (buffer - start) + length;
+}
@@ -0,0 +1,11 @@
+#ifndef CLOX_DTOA_H
+#define CLOX_DTOA_H
+
+#include "common.h"
+
+#define NUMBER_BUFFER_SIZE 32 //가장 긴 출력 "-1.2345678901234567e-308" + '\0'보다 넉넉하게
+
+//number를 다시 읽으면 같은 double이 되는 짧은 10진 표기로 buffer에 쓰고 길이를 반환한다 ('\0'도 씀)
+int formatNumber(double number, char *buffer);
+
+#endif //CLOX_DTOA_H
@@ -1,8 +1,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "vm.h"
+#include "compiler.h"
+#include "bytecode.h"
+#include "snapshot.h"
 
 static void repl() {
     char line[1024];
@@ -17,11 +26,12 @@ static void repl() {
     }
 }
 
-static char *readFile(const char *path) {
+static char *loadFile(const char *path, FILE *err) {
+    //실패하면 err에 이유를 쓰고 NULL을 반환한다 (작업자 스레드는 프로세스를 끝낼 수 없다)
     FILE *file = fopen(path, "rb");
     if (file == NULL) { //시스템에 파일이 존재하지 않거나, 사용자가 파일에 액세스할 권한이 없을 경우, 혹은 경로가 틀린 경우
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);
+        fprintf(err, "Could not open file \"%s\".\n", path);
+        return NULL;
     }
     fseek(file, 0L, SEEK_END); //fseek()으로 파일 끝을 찾음
     size_t fileSize = ftell(file);//ftell()을 호출해서 파일 시작부에서 몇 바이트나 떨어져있는지 알아냄
@@ -29,12 +39,13 @@ static char *readFile(const char *path) {
 
     char *buffer = (char *) malloc(fileSize + 1); // + null byte
     if (buffer == NULL) { //메모리 부족일 경우
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+        fprintf(err, "Not enough memory to read \"%s\".\n", path);
+        fclose(file);
+        return NULL;
     }
     size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
     if (bytesRead < fileSize) { // read fail
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        fprintf(err, "Could not read file \"%s\".\n", path);
     }
     buffer[bytesRead] = '\0';
 
@@ -42,24 +53,359 @@ static char *readFile(const char *path) {
     return buffer;
 }
 
-static void runFile(const char *path) {
+static char *readFile(const char *path) {
+    char *buffer = loadFile(path, stderr);
+    if (buffer == NULL) exit(74);
+    return buffer;
+}
+
+static bool hasSuffix(const char *string, const char *suffix) {
+    size_t length = strlen(string);
+    size_t suffixLength = strlen(suffix);
+    return length >= suffixLength && strcmp(string + length - suffixLength, suffix) == 0;
+}
+
+static char *bytecodePath(const char *path) {
+    //script.lox -> script.loxc (확장자가 다르면 .loxc를 붙인다)
+    size_t length = strlen(path);
+    char *result = (char *) malloc(length + 6);
+    memcpy(result, path, length + 1);
+    strcat(result, hasSuffix(path, ".lox") ? "c" : ".loxc");
+    return result;
+}
+
+static void compileFile(const char *path, const char *output) {
+    //--compile-only: 실행하지 않고 .loxc만 만든다
     char *source = readFile(path);
-    InterpretResult result = interpret(source);
+    ObjFunction *function = compile(source);
+    if (function == NULL) {
+        free(source);
+        exit(65);
+    }
+    char *target = output != NULL ? strdup(output) : bytecodePath(path);
+    bool written = writeBytecode(function, hashSource(source), target);
+    free(source);
+    if (!written) {
+        fprintf(stderr, "Could not write bytecode file \"%s\".\n", target);
+        free(target);
+        exit(74);
+    }
+    free(target);
+}
+
+static InterpretResult runSource(const char *path, char *source, bool useCache) {
+    //source는 여기서 해제한다
+    if (!useCache) {
+        InterpretResult result = interpret(source);
+        free(source);
+        return result;
+    }
+
+    //--cache: 소스 해시가 같은 .loxc가 있으면 컴파일하지 않고 그것을 실행한다. 없거나 낡았으면 컴파일하고 새로 쓴다
+    uint64_t sourceHash = hashSource(source);
+    char *cachePath = bytecodePath(path);
+    const char *error;
+    ObjFunction *function = loadBytecode(cachePath, true, sourceHash, &error);
+    if (function == NULL) {
+        function = compile(source);
+        if (function != NULL) writeBytecode(function, sourceHash, cachePath); //캐시를 못 쓰는 것은 에러가 아니다
+    }
+    free(cachePath);
     free(source);
+    if (function == NULL) return INTERPRET_COMPILE_ERROR;
+    return interpretFunction(function); //.loxc의 mmap은 freeVM이 해제한다 (전역 변수나 --snapshot-out이 함수를 계속 쓴다)
+}
+
+static InterpretResult runBytecode(const char *path) {
+    const char *error;
+    ObjFunction *function = loadBytecode(path, false, 0, &error);
+    if (function == NULL) {
+        fprintf(stderr, "Could not load \"%s\": %s\n", path, error);
+        exit(65);
+    }
+    return interpretFunction(function);
+}
+
+static void runFile(const char *path, bool useCache) {
+    InterpretResult result = hasSuffix(path, ".loxc") ? runBytecode(path) : runSource(path, readFile(path), useCache);
+    if (vm.countInstructions) {
+        //벤치마크 runner가 읽어가는 형식 (stderr)
+        fprintf(stderr, "instructions=%" PRIu64 "\n", vm.instructionCount);
+    }
 
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
+//디렉터리 모드: 디렉터리 안의 *.lox 스크립트들을 작업자 스레드 풀에서 실행한다.
+//스크립트마다 자기 스레드에서 새 isolate(initVM ~ freeVM)를 만들므로 전역 변수나 heap을 공유하지 않는다.
+//출력은 스크립트별 버퍼에 모았다가 메인 스레드가 파일 이름 순서대로 내보낸다 (실행 순서와 무관하게 항상 같은 출력)
+typedef struct {
+    char *path;
+    char *output; //println 출력
+    size_t outputSize;
+    char *errors; //에러 메시지
+    size_t errorsSize;
+    int status; //단일 스크립트 실행과 같은 종료 코드 (0, 65, 70, 74)
+    uint64_t instructionCount;
+    bool done;
+} Job;
+
+typedef struct {
+    Job *jobs;
+    int count;
+    atomic_int next; //다음에 가져갈 job
+    pthread_mutex_t lock;
+    pthread_cond_t finished; //job 하나가 끝날 때마다 알린다
+
+    const char *snapshot; //isolate마다 같은 이미지에서 시작한다
+    bool useCache;
+    bool lazyCompile;
+    bool countInstructions;
+} JobQueue;
+
+static int exitStatus(InterpretResult result) {
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+static void runJob(JobQueue *queue, Job *job) {
+    FILE *out = open_memstream(&job->output, &job->outputSize);
+    FILE *err = open_memstream(&job->errors, &job->errorsSize);
+    if (out == NULL || err == NULL) exit(74);
+
+    initVM();
+    vm.out = out;
+    vm.err = err;
+    vm.lazyCompile = queue->lazyCompile;
+    vm.countInstructions = queue->countInstructions;
+
+    const char *error;
+    char *source;
+    if (queue->snapshot != NULL && !loadSnapshot(queue->snapshot, &error)) {
+        fprintf(err, "Could not load snapshot \"%s\": %s\n", queue->snapshot, error);
+        job->status = 65;
+    } else if ((source = loadFile(job->path, err)) == NULL) {
+        job->status = 74;
+    } else {
+        job->status = exitStatus(runSource(job->path, source, queue->useCache));
+    }
+    job->instructionCount = vm.instructionCount;
+
+    freeVM();
+    fclose(out);
+    fclose(err);
+}
+
+static void *worker(void *arg) {
+    JobQueue *queue = (JobQueue *) arg;
+    for (;;) {
+        int index = atomic_fetch_add(&queue->next, 1);
+        if (index >= queue->count) return NULL;
+        Job *job = &queue->jobs[index];
+        runJob(queue, job);
+
+        pthread_mutex_lock(&queue->lock);
+        job->done = true;
+        pthread_cond_broadcast(&queue->finished);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+static int compareJobs(const void *a, const void *b) {
+    return strcmp(((const Job *) a)->path, ((const Job *) b)->path);
+}
+
+static int collectScripts(const char *directory, Job **jobs) {
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        fprintf(stderr, "Could not open directory \"%s\".\n", directory);
+        exit(74);
+    }
+    int count = 0;
+    int capacity = 0;
+    *jobs = NULL;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || !hasSuffix(entry->d_name, ".lox")) continue; //--cache가 만든 .loxc는 건너뛴다
+        if (count == capacity) {
+            capacity = capacity < 8 ? 8 : capacity * 2;
+            *jobs = (Job *) realloc(*jobs, sizeof(Job) * capacity);
+            if (*jobs == NULL) exit(1);
+        }
+        Job *job = &(*jobs)[count++];
+        memset(job, 0, sizeof(Job));
+        size_t length = strlen(directory) + strlen(entry->d_name) + 2;
+        job->path = (char *) malloc(length);
+        snprintf(job->path, length, "%s/%s", directory, entry->d_name);
+    }
+    closedir(dir);
+    qsort(*jobs, count, sizeof(Job), compareJobs);
+    return count;
+}
+
+static int runDirectory(const char *directory, int workerCount, JobQueue *queue) {
+    queue->count = collectScripts(directory, &queue->jobs);
+    atomic_init(&queue->next, 0);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->finished, NULL);
+
+    if (workerCount <= 0) workerCount = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (workerCount > queue->count) workerCount = queue->count;
+    if (workerCount < 1) workerCount = 1;
+    pthread_t *threads = (pthread_t *) malloc(sizeof(pthread_t) * workerCount);
+    for (int i = 0; i < workerCount; i++) {
+        if (pthread_create(&threads[i], NULL, worker, queue) != 0) {
+            fprintf(stderr, "Could not start worker thread.\n");
+            exit(71);
+        }
+    }
+
+    //끝난 순서가 아니라 파일 이름 순서로 내보낸다. 앞의 스크립트가 끝나기를 기다리는 동안에도 작업자들은 계속 실행한다
+    int status = 0;
+    uint64_t instructionCount = 0;
+    for (int i = 0; i < queue->count; i++) {
+        Job *job = &queue->jobs[i];
+        pthread_mutex_lock(&queue->lock);
+        while (!job->done) pthread_cond_wait(&queue->finished, &queue->lock);
+        pthread_mutex_unlock(&queue->lock);
+
+        fwrite(job->output, 1, job->outputSize, stdout);
+        fflush(stdout);
+        fwrite(job->errors, 1, job->errorsSize, stderr);
+        if (job->status != 0) {
+            fprintf(stderr, "%s: exited with %d\n", job->path, job->status);
+            if (status == 0) status = job->status; //첫번째로 실패한 스크립트의 종료 코드
+        }
+        instructionCount += job->instructionCount;
+        free(job->output);
+        free(job->errors);
+        free(job->path);
+    }
+
+    for (int i = 0; i < workerCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(queue->jobs);
+    pthread_cond_destroy(&queue->finished);
+    pthread_mutex_destroy(&queue->lock);
+
+    if (queue->countInstructions) {
+        fprintf(stderr, "instructions=%" PRIu64 "\n", instructionCount);
+    }
+    return status;
+}
+
+static bool isDirectory(const char *path) {
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: clox [--trace] [--disasm] [--stats] [--lazy | --cache] [--snapshot image.loxs] [path]\n"
+                    "       clox [--stats] [--lazy | --cache] [--snapshot image.loxs] [--workers n] directory\n"
+                    "       clox --compile-only [-o out.loxc] path\n"
+                    "       clox --snapshot-out image.loxs prelude\n");
+    freeVM();
+    exit(64);
+}
+
 int main(int argc, const char *argv[]) {
     initVM();
 
-    if (argc == 1) {
+    const char *path = NULL;
+    const char *output = NULL;
+    const char *snapshot = NULL;
+    const char *snapshotOut = NULL;
+    bool compileOnly = false;
+    bool useCache = false;
+    int workerCount = 0; //0이면 CPU 수만큼
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0) {
+            vm.traceExecution = true;
+        } else if (strcmp(argv[i], "--disasm") == 0) {
+            vm.printCode = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            vm.countInstructions = true;
+        } else if (strcmp(argv[i], "--compile-only") == 0) {
+            compileOnly = true;
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            vm.lazyCompile = true;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            useCache = true;
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc && snapshot == NULL) {
+            snapshot = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot-out") == 0 && i + 1 < argc && snapshotOut == NULL) {
+            snapshotOut = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            workerCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc && output == NULL) {
+            output = argv[++i];
+        } else if (path == NULL && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if (output != NULL && !compileOnly) usage(); //-o는 --compile-only의 출력 파일이다
+
+    if (compileOnly || useCache || snapshotOut != NULL) {
+        //.loxc와 스냅샷에는 컴파일된 본문만 저장할 수 있으므로 lazy 컴파일을 끈다
+        vm.lazyCompile = false;
+    }
+    if (path != NULL && isDirectory(path)) {
+        //isolate마다 자기 스레드에서 initVM부터 다시 하므로 메인 스레드의 VM은 쓰지 않는다
+        if (compileOnly || snapshotOut != NULL || vm.traceExecution || vm.printCode) {
+            fprintf(stderr, "A directory can only be run, not compiled, traced or snapshotted.\n");
+            freeVM();
+            exit(64);
+        }
+        JobQueue queue = {
+                .snapshot = snapshot,
+                .useCache = useCache,
+                .lazyCompile = vm.lazyCompile,
+                .countInstructions = vm.countInstructions,
+        };
+        int status = runDirectory(path, workerCount, &queue);
+        freeVM();
+        return status;
+    }
+    if (snapshot != NULL) {
+        //다른 무엇보다 먼저: 이미지의 전역 변수와 인터닝 테이블이 initVM이 만든 것을 대신한다
+        const char *error;
+        if (!loadSnapshot(snapshot, &error)) {
+            fprintf(stderr, "Could not load snapshot \"%s\": %s\n", snapshot, error);
+            freeVM();
+            exit(65);
+        }
+    }
+    if (snapshotOut != NULL) {
+        //--snapshot-out: prelude를 실행한 뒤의 heap을 저장한다. 이후 --snapshot으로 prelude 없이 바로 시작할 수 있다
+        if (path == NULL || compileOnly) {
+            fprintf(stderr, "--snapshot-out needs a prelude path.\n");
+            freeVM();
+            exit(64);
+        }
+        runFile(path, useCache);
+        const char *error;
+        if (!writeSnapshot(snapshotOut, &error)) {
+            fprintf(stderr, "Could not write snapshot \"%s\": %s\n", snapshotOut, error);
+            freeVM();
+            exit(74);
+        }
+    } else if (compileOnly) {
+        if (path == NULL) {
+            fprintf(stderr, "--compile-only needs a source path.\n");
+            freeVM();
+            exit(64);
+        }
+        compileFile(path, output);
+    } else if (path == NULL) {
         repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
+        runFile(path, useCache);
     }
 
     freeVM();
@@ -1,8 +1,136 @@
 #include <stdlib.h>
+#include "compiler.h"
+#include "snapshot.h"
 #include "vm.h"
 #include "memory.h"
 
+#ifdef POOL_ALLOCATOR
+#include <sys/mman.h>
+#endif
+
+#ifdef DEBUG_LOG_GC
+#include <stdio.h>
+#endif
+
+#define GC_HEAP_GROW_FACTOR 2 //수집 후 살아남은 heap 크기에 비례해서 다음 임계값을 정한다
+
+#ifdef POOL_ALLOCATOR
+//POOL_MAX_SIZE 이하의 작은 할당(Obj 헤더, 짧은 문자열, 작은 배열)은 16 bytes 단위 size class별 free list에서 꺼낸다.
+//pool은 mmap으로 받은 64KB chunk를 bump pointer로 잘라 쓰고, 해제된 블록은 같은 class의 free list에 O(1)로 돌아간다.
+//reallocate()는 항상 oldSize를 정확히 넘겨받으므로 블록마다 크기 헤더를 둘 필요가 없다.
+#define POOL_GRANULE 16
+#define POOL_MAX_SIZE 256
+#define POOL_CLASS_COUNT (POOL_MAX_SIZE / POOL_GRANULE)
+#define POOL_CHUNK_SIZE (64 * 1024)
+#define SIZE_CLASS(size) (((size) - 1) / POOL_GRANULE)
+
+typedef struct PoolBlock {
+    struct PoolBlock *pNext;
+} PoolBlock;
+
+typedef struct PoolChunk { //mmap으로 받은 chunk의 맨 앞에 위치, VM 종료 시 munmap하기 위해 연결해둔다
+    struct PoolChunk *pNext;
+} PoolChunk;
+
+typedef struct {
+    PoolBlock *freeLists[POOL_CLASS_COUNT];
+    char *bump; //현재 chunk에서 아직 잘라 쓰지 않은 영역
+    char *limit;
+    PoolChunk *chunks;
+} Pool;
+
+static _Thread_local Pool pool; //isolate마다 따로 (스레드 간 잠금 없음)
+
+static void poolFree(void *pointer, size_t size) {
+    PoolBlock *block = (PoolBlock *) pointer;
+    int sizeClass = SIZE_CLASS(size);
+    block->pNext = pool.freeLists[sizeClass];
+    pool.freeLists[sizeClass] = block;
+}
+
+static void newPoolChunk() {
+    //현재 chunk의 남은 자투리는 들어갈 수 있는 가장 큰 class의 free list로 넘긴다
+    while (pool.limit - pool.bump >= POOL_GRANULE) {
+        size_t size = (size_t) (pool.limit - pool.bump);
+        if (size > POOL_MAX_SIZE) size = POOL_MAX_SIZE;
+        size -= size % POOL_GRANULE;
+        poolFree(pool.bump, size);
+        pool.bump += size;
+    }
+
+    void *memory = mmap(NULL, POOL_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) exit(1);
+
+    PoolChunk *chunk = (PoolChunk *) memory;
+    chunk->pNext = pool.chunks;
+    pool.chunks = chunk;
+    pool.bump = (char *) memory + POOL_GRANULE; //chunk 헤더 자리를 건너뛴다 (16 bytes 정렬 유지)
+    pool.limit = (char *) memory + POOL_CHUNK_SIZE;
+}
+
+static void *poolAllocate(size_t size) {
+    int sizeClass = SIZE_CLASS(size);
+    PoolBlock *block = pool.freeLists[sizeClass];
+    if (block != NULL) {
+        pool.freeLists[sizeClass] = block->pNext;
+        return block;
+    }
+
+    size_t blockSize = (size_t) (sizeClass + 1) * POOL_GRANULE;
+    if (pool.limit - pool.bump < (ptrdiff_t) blockSize) newPoolChunk();
+    void *result = pool.bump;
+    pool.bump += blockSize;
+    return result;
+}
+
+static void freePools() {
+    PoolChunk *chunk = pool.chunks;
+    while (chunk != NULL) {
+        PoolChunk *pNext = chunk->pNext;
+        munmap(chunk, POOL_CHUNK_SIZE);
+        chunk = pNext;
+    }
+    memset(&pool, 0, sizeof(Pool));
+}
+#endif
+
 void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
+    vm.bytesAllocated += newSize - oldSize;
+    if (newSize > oldSize) {
+#ifdef DEBUG_STRESS_GC
+        collectGarbage(); //할당할 때마다 수집해서 root 누락 버그를 바로 드러낸다
+#endif
+        if (vm.bytesAllocated > vm.nextGC) {
+            collectGarbage();
+        }
+    }
+
+#ifdef POOL_ALLOCATOR
+    bool oldInPool = pointer != NULL && oldSize <= POOL_MAX_SIZE;
+    bool newInPool = newSize != 0 && newSize <= POOL_MAX_SIZE;
+    if (oldInPool || newInPool) {
+        if (oldInPool && newInPool && SIZE_CLASS(oldSize) == SIZE_CLASS(newSize)) {
+            return pointer; //같은 size class 안에서는 블록을 그대로 쓴다
+        }
+        void *result = NULL;
+        if (newInPool) {
+            result = poolAllocate(newSize);
+        } else if (newSize != 0) {
+            result = malloc(newSize); //큰 할당은 시스템 할당자로
+            if (result == NULL) exit(1);
+        }
+        if (pointer != NULL) {
+            if (result != NULL) memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+            if (oldInPool) {
+                poolFree(pointer, oldSize);
+            } else {
+                free(pointer);
+            }
+        }
+        return result;
+    }
+#endif
+
     if (newSize == 0) {
         free(pointer);
         return NULL;
@@ -13,17 +141,106 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
+void markObject(Obj *object) {
+    if (object == NULL) return;
+    if (object->isMarked) return; //순환 참조에서 무한 루프 방지
+#ifdef DEBUG_LOG_GC
+    printf("%p mark ", (void *) object);
+    printValue(stdout, OBJ_VAL(object));
+    printf("\n");
+#endif
+    object->isMarked = true;
+
+    if (vm.grayCapacity < vm.grayCount + 1) {
+        //gray stack은 GC 자체의 메모리이므로 reallocate()를 거치지 않는다 (재귀적으로 GC가 돌지 않도록)
+        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
+        vm.grayStack = (Obj **) realloc(vm.grayStack, sizeof(Obj *) * vm.grayCapacity);
+        if (vm.grayStack == NULL) exit(1);
+    }
+    vm.grayStack[vm.grayCount++] = object;
+}
+
+void markValue(Value value) {
+    if (IS_OBJ(value)) markObject(AS_OBJ(value)); //숫자, bool, nil은 heap 할당이 없다
+}
+
+static void markArray(ValueArray *array) {
+    for (int i = 0; i < array->count; i++) {
+        markValue(array->values[i]);
+    }
+}
+
+static void markFiberStack(FiberStack *stack) {
+    for (Value *slot = stack->stack; slot < stack->stackTop; slot++) {
+        markValue(*slot);
+    }
+    for (int i = 0; i < stack->frameCount; i++) {
+        markObject((Obj *) stack->frames[i].closure);
+    }
+    for (ObjUpValue *upValue = stack->openUpValues; upValue != NULL; upValue = upValue->pNext) {
+        markObject((Obj *) upValue);
+    }
+}
+
+static void blackenObject(Obj *object) {
+    //gray 객체가 참조하는 객체들을 모두 mark하면 black이 된다
+#ifdef DEBUG_LOG_GC
+    printf("%p blacken ", (void *) object);
+    printValue(stdout, OBJ_VAL(object));
+    printf("\n");
+#endif
+    switch (object->type) {
+        case OBJ_CLOSURE: {
+            ObjClosure *closure = (ObjClosure *) object;
+            markObject((Obj *) closure->function);
+            for (int i = 0; i < closure->upValueCount; i++) {
+                markObject((Obj *) closure->upValues[i]);
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction *function = (ObjFunction *) object;
+            markObject((Obj *) function->name);
+            markArray(&function->chunk.constants);
+            if (function->lazy != NULL) markLazyFunction(function->lazy);
+            break;
+        }
+        case OBJ_UPVALUE:
+            markValue(((ObjUpValue *) object)->closed);
+            break;
+        case OBJ_ROPE: {
+            ObjRope *rope = (ObjRope *) object;
+            markObject(rope->left);
+            markObject(rope->right);
+            markObject((Obj *) rope->flat);
+            break;
+        }
+        case OBJ_FIBER: {
+            ObjFiber *fiber = (ObjFiber *) object;
+            markObject((Obj *) fiber->caller);
+            if (fiber != vm.fiber) markFiberStack(&fiber->saved); //실행 중인 fiber의 스택은 markRoots가 VM에서 읽는다
+            break;
+        }
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+            break;
+    }
+}
+
 static void freeObject(Obj *object) {
+#ifdef DEBUG_LOG_GC
+    printf("%p free type %d\n", (void *) object, object->type);
+#endif
     switch (object->type) {
         case OBJ_CLOSURE: {
             ObjClosure *closure = (ObjClosure *)object;
-            FREE_ARRAY(ObjUpValue*, closure->upValues, closure->upValueCount);
-            FREE(ObjClosure, object);
+            reallocate(object, sizeof(ObjClosure) + sizeof(ObjUpValue *) * closure->upValueCount, 0);
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction *function = (ObjFunction *) object;
             freeChunk(&function->chunk);
+            if (function->lazy != NULL) freeLazyFunction(function->lazy);
             FREE(ObjFunction, object);
             break;
         }
@@ -32,14 +249,102 @@ static void freeObject(Obj *object) {
             break;
         case OBJ_STRING: {
             ObjString *string = (ObjString *) object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(ObjString, object);
+            reallocate(object, STRING_SIZE(string->length), 0);
             break;
         }
+        case OBJ_ROPE:
+            FREE(ObjRope, object);
+            break;
         case OBJ_UPVALUE:
             FREE(ObjUpValue, object);
             break;
+        case OBJ_FIBER: {
+            FiberStack *stack = &((ObjFiber *) object)->saved;
+            FREE_ARRAY(Value, stack->stack, stack->stackCapacity);
+            FREE_ARRAY(CallFrame, stack->frames, stack->frameCapacity);
+            FREE(ObjFiber, object);
+            break;
+        }
+    }
+}
+
+static void markRoots() {
+    for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
+        markValue(*slot);
+    }
+
+    for (int i = 0; i < vm.frameCount; i++) {
+        markObject((Obj *) vm.frames[i].closure);
+    }
+
+    for (ObjUpValue *upValue = vm.openUpValues; upValue != NULL; upValue = upValue->pNext) {
+        markObject((Obj *) upValue);
+    }
+
+    if (vm.fiber != NULL) {
+        //fiber가 실행 중이면 위는 그 fiber의 스택이다. 메인 스크립트와 resume한 fiber들은 저장된 상태에서 mark한다
+        markObject((Obj *) vm.fiber);
+        markFiberStack(&vm.root);
+    }
+
+    markTable(&vm.globals.slots);
+    markArray(&vm.globals.values);
+    for (int i = 0; i < vm.globals.vars.count; i++) {
+        markObject((Obj *) READ_AS(GlobalVar, &vm.globals.vars, i).name);
     }
+    for (int i = 0; i < SMALL_INT_STRINGS; i++) {
+        markObject((Obj *) vm.smallIntStrings[i]);
+    }
+    markCompilerRoots();
+    markSnapshotRoots();
+}
+
+static void traceReferences() {
+    while (vm.grayCount > 0) {
+        Obj *object = vm.grayStack[--vm.grayCount];
+        blackenObject(object);
+    }
+}
+
+static void sweep() {
+    Obj *previous = NULL;
+    Obj *object = vm.objects;
+    while (object != NULL) {
+        if (object->isMarked) {
+            object->isMarked = false; //다음 GC를 위해 white로 되돌린다
+            previous = object;
+            object = object->pNext;
+        } else {
+            Obj *unreached = object;
+            object = object->pNext;
+            if (previous != NULL) {
+                previous->pNext = object;
+            } else {
+                vm.objects = object;
+            }
+            freeObject(unreached);
+        }
+    }
+}
+
+void collectGarbage() {
+#ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+    size_t before = vm.bytesAllocated;
+#endif
+
+    markRoots();
+    traceReferences();
+    stringSetRemoveWhite(&vm.strings); //vm.strings는 weak set
+    sweep();
+
+    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc end\n");
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+           before - vm.bytesAllocated, before, vm.bytesAllocated, vm.nextGC);
+#endif
 }
 
 void freeObjects() {
@@ -49,6 +354,11 @@ void freeObjects() {
         freeObject(Object);
         Object = pNext;
     }
+
+    free(vm.grayStack);
+#ifdef POOL_ALLOCATOR
+    freePools();
+#endif
 }
 
 void initArray(Array *array, size_t type) {
@@ -69,8 +379,12 @@ void writeArray(Array *array, void *value) {
 }
 
 void freeArray(Array *array) {
-    FREE_ARRAY(uint8_t, array->values, array->capacity);
+    reallocate(array->values, array->type * array->capacity, 0);
     initArray(array, array->type);
 }
 
 //memory fragmentation에 대해서 어떤 조치를 취할 것인가
+// -> 작은 객체는 POOL_ALLOCATOR의 size class별 pool에서 할당한다. 같은 크기의 블록끼리만 free list를 공유하므로
+//    해제된 블록은 다음 같은 크기의 할당(대부분 같은 타입의 Obj)에 그대로 재사용되고, 크기가 섞이면서 생기는 외부 단편화가 없다.
+//    낭비는 class 내부의 반올림(최대 15 bytes)과 chunk 끝의 자투리로 제한되며, 자투리도 free list로 돌려보낸다.
+//    256 bytes를 넘는 배열(상수 배열, 코드, 해시 테이블)은 크기 변화가 크므로 malloc/realloc에 맡긴다.
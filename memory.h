@@ -23,7 +23,7 @@ typedef struct {
     (type*)reallocate((pointer), sizeof(type) * (oldCapacity), sizeof(type) * (newCapacity))
 
 #define GROW_ARRAY_FOR_TYPE_SIZE(typeSize, pointer, oldCapacity, newCapacity) \
-    reallocate((pointer), (typeSize) * (oldCapacity), sizeof(typeSize) * (newCapacity))
+    reallocate((pointer), (typeSize) * (oldCapacity), (typeSize) * (newCapacity))
 
 #define FREE_ARRAY(type, pointer, oldCount) \
     reallocate(pointer, sizeof(type) * (oldCount), 0)
@@ -32,6 +32,12 @@ typedef struct {
 
 void *reallocate(void *pointer, size_t oldSize, size_t newSize);
 
+void markObject(Obj *object);
+
+void markValue(Value value);
+
+void collectGarbage();
+
 void freeObjects();
 
 void initArray(Array *array, size_t size);
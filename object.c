@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "table.h"
@@ -10,26 +11,36 @@
 #define ALLOCATE_OBJ(type, objectType) \
     (type*)allocateObject(sizeof(type), objectType)
 
+static void linkObject(Obj *object, size_t size) {
+    //GC가 추적하도록 객체 리스트에 연결한다
+    object->isMarked = false;
+    object->pNext = vm.objects;
+    vm.objects = object;
+
+#ifdef DEBUG_LOG_GC
+    printf("%p allocate %zu for %d\n", (void *) object, size, object->type);
+#else
+    (void) size;
+#endif
+}
+
 static Obj *allocateObject(size_t size, ObjType type) {
     //주어진 크기(객체 자체의 크기가 아님을 주의)의 객체를 힙에 할당함
     //객체 생성에 필요한 추가 payload 필드용 공간 확보를 위함
     Obj *object = (Obj *) reallocate(NULL, 0, size);
     object->type = type;
-
-    object->pNext = vm.objects;
-    vm.objects = object;
+    linkObject(object, size);
     return object;
 }
 
 ObjClosure *newClosure(ObjFunction *function) {
-    ObjUpValue** upValues = ALLOCATE(ObjUpValue*, function->upValueCount);
-    for (int i = 0; i < function->upValueCount; i++) {
-        upValues[i] = NULL;
-    }
-    ObjClosure *closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
+    ObjClosure *closure = (ObjClosure *) allocateObject(
+            sizeof(ObjClosure) + sizeof(ObjUpValue *) * function->upValueCount, OBJ_CLOSURE);
     closure->function = function;
-    closure->upValues = upValues;
     closure->upValueCount = function->upValueCount;
+    for (int i = 0; i < function->upValueCount; i++) {
+        closure->upValues[i] = NULL; //OP_CLOSURE가 채우기 전에 GC가 돌 수 있으므로 NULL로 초기화
+    }
     return closure;
 }
 
@@ -37,7 +48,9 @@ ObjFunction *newFunction() {
     ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upValueCount = 0;
+    function->maxSlots = 0;
     function->name = NULL;
+    function->lazy = NULL;
     initChunk(&function->chunk);
     return function;
 }
@@ -49,49 +62,115 @@ ObjNative *newNative(NativeFn function) {
     return native;
 }
 
-static ObjString *allocateString(char *chars, int length, uint32_t hash) {
-    //OOP의 생성자와 유사한 기능을 한다
-    ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
-    //ObjString *string = (ObjString*)allocateObject(sizeof(ObjString*), OBJ_STRING);
+ObjString *allocateString(int length) {
+    //헤더와 문자 배열을 한 번에 할당한다. 호출자가 chars를 직접 채운 뒤 internString() 또는 finishString()에 넘긴다.
+    //인터닝 전에는 객체 리스트에 연결하지 않는다: 이미 같은 문자열이 있으면 GC를 거치지 않고 바로 버릴 수 있다
+    ObjString *string = (ObjString *) reallocate(NULL, 0, STRING_SIZE(length));
+    string->obj.type = OBJ_STRING;
     string->length = length;
-    string->chars = chars;
+    string->chars[length] = '\0';
+    return string;
+}
+
+static ObjString *addString(ObjString *string, uint32_t hash) {
+    //새 문자열을 GC 객체 리스트와 인터닝 테이블에 등록한다
     string->hash = hash;
-    tableSet(&vm.strings, string, NIL_VAL, false); //문자열 상수는 const가 아니므로 entry->isConst는 false
+#ifdef LAZY_INTERN
+    string->isInterned = true;
+#endif
+    linkObject((Obj *) string, STRING_SIZE(string->length));
+    push(OBJ_VAL(string)); //테이블이 커지면서 GC가 돌 수 있으므로 스택에 올려둔다
+    if (vm.strings.count + 1 > vm.strings.capacity * TABLE_MAX_LOAD) {
+        //인터닝 테이블이 커지기 직전에 먼저 수집한다. 그렇지 않으면 아직 수거되지 않은 죽은 문자열들 때문에
+        //테이블이 계속 두 배로 커지고, 커진 테이블 크기가 다시 다음 GC 임계값을 키운다
+        collectGarbage();
+    }
+    stringSetAdd(&vm.strings, string);
+    pop();
     return string;
 }
 
-static uint32_t hashString(const char *key, int length) {
-    //FNV-1a algorithm
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t) key[i];
-        hash *= 16777619;
+static inline uint64_t hashMix(uint64_t hash, uint64_t word) {
+    hash = (hash ^ word) * 0xbf58476d1ce4e5b9u;
+    return hash ^ (hash >> 31);
+}
+
+uint32_t hashString(const char *key, int length) {
+    //8바이트 단위로 읽어 섞는다 (바이트마다 곱셈하던 FNV-1a보다 긴 문자열에서 곱셈 수가 1/8).
+    //vm.hashSeed로 시작값을 바꿀 수 있어서, seed를 모르면 같은 버킷으로 몰리는 key를 미리 만들 수 없다
+    uint64_t hash = vm.hashSeed ^ ((uint64_t) length * 0x9e3779b97f4a7c15u);
+    const char *p = key;
+    int remaining = length;
+    while (remaining >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8); //정렬되지 않은 주소도 안전하게 읽는다 (한 번의 load로 컴파일됨)
+        hash = hashMix(hash, word);
+        p += 8;
+        remaining -= 8;
+    }
+    if (remaining > 0) {
+        //남은 1~7바이트는 고정 크기 load 몇 번으로 모은다 (길이가 가변인 memcpy는 함수 호출이 된다).
+        //길이가 시작값에 섞여 있으므로 겹쳐 읽어도 길이가 다른 문자열끼리 구분된다
+        uint64_t word;
+        if (length >= 8) {
+            memcpy(&word, key + length - 8, 8); //마지막 8바이트 (앞 word와 겹침)
+        } else if (remaining >= 4) {
+            uint32_t low, high;
+            memcpy(&low, p, 4);
+            memcpy(&high, p + remaining - 4, 4);
+            word = ((uint64_t) high << 32) | low;
+        } else {
+            word = (uint64_t) (uint8_t) p[0] | (uint64_t) (uint8_t) p[remaining >> 1] << 8 |
+                   (uint64_t) (uint8_t) p[remaining - 1] << 16;
+        }
+        hash = hashMix(hash, word);
     }
-    return hash;
+    //murmur3 finalizer: 하위 비트(버킷 인덱스로 쓰이는 부분)까지 고르게 섞는다
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdu;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53u;
+    hash ^= hash >> 33;
+    return (uint32_t) hash;
 }
 
-ObjString *takeString(char *chars, int length) {
-    uint32_t hash = hashString(chars, length);
-    ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+ObjString *internString(ObjString *string) {
+    //allocateString()으로 만들어 채운 문자열을 인터닝한다. 같은 문자열이 이미 있으면 새 객체를 해제하고 기존 것을 돌려준다
+    uint32_t hash = hashString(string->chars, string->length);
+    ObjString *interned = stringSetFind(&vm.strings, string->chars, string->length, hash);
 
     if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
+        reallocate(string, STRING_SIZE(string->length), 0);
         return interned;
     }
 
-    return allocateString(chars, length, hash);
+    return addString(string, hash);
+}
+
+ObjString *finishString(ObjString *string) {
+    //런타임에 만든 문자열(연결, 보간, rope flatten)을 마무리한다.
+    //LAZY_INTERN이면 해싱/인터닝 없이 GC 리스트에만 연결한다: 한 번 출력하고 버리는 문자열은 해시를 계산하지 않고
+    //인터닝 테이블도 키우지 않는다. 동등 비교는 valuesEqual이 내용으로 한다 (stringsEqual).
+    //테이블 key는 포인터로 비교하므로 key로 쓰는 문자열은 copyString/internString으로 만들어야 한다
+#ifdef LAZY_INTERN
+    string->hash = 0;
+    string->isInterned = false;
+    linkObject((Obj *) string, STRING_SIZE(string->length));
+    return string;
+#else
+    return internString(string);
+#endif
 }
 
 ObjString *copyString(const char *chars, int length) {
     //사용자가 전달할 문자의 소유권을 가져올 수 없다고 가정함
     uint32_t hash = hashString(chars, length);
-    ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString *interned = stringSetFind(&vm.strings, chars, length, hash);
     if (interned != NULL) return interned;
 
-    char *heapChars = ALLOCATE(char, length + 1);
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0';
-    return allocateString(heapChars, length, hash);
+    ObjString *string = allocateString(length);
+    memcpy(string->chars, chars, length);
+    return addString(string, hash);
 }
 
 ObjUpValue *newUpValue(Value *slot) {
@@ -102,31 +181,132 @@ ObjUpValue *newUpValue(Value *slot) {
     return upValue;
 }
 
+ObjFiber *newFiber(ObjClosure *closure) {
+    //값 스택은 함수의 첫 호출에 필요한 만큼(closure, 인자 하나, 여유분)으로 작게 시작한다. 더 깊이 호출하면 call()이 늘린다
+    int capacity = closure->function->maxSlots + UINT8_COUNT + 2;
+    ObjFiber *fiber = ALLOCATE_OBJ(ObjFiber, OBJ_FIBER);
+    fiber->state = FIBER_NEW;
+    fiber->caller = NULL;
+    memset(&fiber->saved, 0, sizeof(FiberStack));
+
+    push(OBJ_VAL(fiber)); //스택을 할당하는 동안 GC가 fiber를 회수하지 않도록
+    Value *stack = ALLOCATE(Value, capacity);
+    pop();
+    stack[0] = OBJ_VAL(closure);
+    fiber->saved.stack = stack;
+    fiber->saved.stackTop = stack + 1;
+    fiber->saved.stackCapacity = capacity;
+    return fiber;
+}
+
+#ifdef LAZY_INTERN
+bool stringsEqual(ObjString *a, ObjString *b) {
+    //포인터가 다른 두 문자열의 내용 비교. 둘 다 인터닝되어 있으면 내용도 다르다
+    if (a->isInterned && b->isInterned) return false;
+    if (a->length != b->length) return false;
+    //해시는 처음 비교할 때 계산해서 캐시한다 (0은 "아직 계산 전"; 실제 해시가 0이면 매번 다시 계산할 뿐이다)
+    if (a->hash == 0) a->hash = hashString(a->chars, a->length);
+    if (b->hash == 0) b->hash = hashString(b->chars, b->length);
+    return a->hash == b->hash && memcmp(a->chars, b->chars, a->length) == 0;
+}
+#endif
 
-static void printFunction(ObjFunction *function) {
+ObjRope *newRope(Obj *left, Obj *right, int length) {
+    //호출자는 left, right를 GC root(스택)에 올려둔 상태여야 한다
+    ObjRope *rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    rope->length = length;
+    rope->left = left;
+    rope->right = right;
+    rope->flat = NULL;
+    return rope;
+}
+
+void copyRope(ObjRope *rope, char *dest) {
+    //조각들을 dest에 이어 붙인다. 재귀 대신 작업 스택을 쓰고 오른쪽 조각부터 끝에서 앞으로 채운다:
+    //반복된 s = s + x가 만드는 왼쪽으로 깊은 rope는 작업 스택이 거의 자라지 않는다.
+    //GC가 돌지 않도록 작업 스택은 reallocate()가 아닌 realloc()으로 관리한다 (grayStack과 같은 이유)
+    Obj **pending = NULL;
+    int pendingCount = 0;
+    int pendingCapacity = 0;
+    char *end = dest + rope->length;
+    Obj *node = (Obj *) rope;
+    for (;;) {
+        ObjRope *branch = node->type == OBJ_ROPE ? (ObjRope *) node : NULL;
+        if (branch != NULL && branch->flat == NULL) {
+            if (pendingCount + 1 > pendingCapacity) {
+                pendingCapacity = GROW_CAPACITY(pendingCapacity);
+                pending = (Obj **) realloc(pending, sizeof(Obj *) * pendingCapacity);
+                if (pending == NULL) exit(1);
+            }
+            pending[pendingCount++] = branch->left;
+            node = branch->right;
+            continue;
+        }
+
+        ObjString *leaf = branch != NULL ? branch->flat : (ObjString *) node;
+        end -= leaf->length;
+        memcpy(end, leaf->chars, leaf->length);
+        if (pendingCount == 0) break;
+        node = pending[--pendingCount];
+    }
+    free(pending);
+}
+
+ObjString *flattenRope(ObjRope *rope) {
+    //호출자는 rope를 GC root(스택)에 올려둔 상태여야 한다. 결과는 finishString()을 거친 평범한 문자열이다
+    if (rope->flat != NULL) return rope->flat;
+
+    ObjString *string = allocateString(rope->length);
+    copyRope(rope, string->chars);
+    rope->flat = finishString(string);
+    rope->left = NULL;
+    rope->right = NULL;
+    return rope->flat;
+}
+
+static void printRope(FILE *out, ObjRope *rope) {
+    //출력만 할 때는 인터닝하지 않는다: 로그처럼 한 번 출력하고 버려지는 큰 문자열을 테이블에 넣을 필요가 없다
+    if (rope->flat != NULL) {
+        fwrite(rope->flat->chars, 1, rope->flat->length, out);
+        return;
+    }
+    char *buffer = (char *) malloc(rope->length);
+    if (buffer == NULL) exit(1);
+    copyRope(rope, buffer);
+    fwrite(buffer, 1, rope->length, out);
+    free(buffer);
+}
+
+static void printFunction(FILE *out, ObjFunction *function) {
     if (function->name == NULL) {
-        printf("<script>");
+        fputs("<script>", out);
         return;
     }
-    printf("<fn %s>", function->name->chars);
+    fprintf(out, "<fn %s>", function->name->chars);
 }
 
-void printObject(Value value) {
+void printObject(FILE *out, Value value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_CLOSURE:
-            printFunction(AS_CLOSURE(value)->function);
+            printFunction(out, AS_CLOSURE(value)->function);
             break;
         case OBJ_FUNCTION:
-            printFunction(AS_FUNCTION(value));
+            printFunction(out, AS_FUNCTION(value));
             break;
         case OBJ_NATIVE:
-            printf("<native fn>");
+            fputs("<native fn>", out);
             break;
         case OBJ_STRING:
-            printf("%s", AS_CSTRING(value));
+            fputs(AS_CSTRING(value), out);
+            break;
+        case OBJ_ROPE:
+            printRope(out, AS_ROPE(value));
             break;
         case OBJ_UPVALUE:
-            printf("upvalue");
+            fputs("upvalue", out);
+            break;
+        case OBJ_FIBER:
+            fputs("<fiber>", out);
             break;
     }
 }
@@ -7,10 +7,13 @@
 //함수는 일급 객체로 취급하기
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
-#define IS_CLOSURE(value) isObjectType(value, OBJ_CLOSURE)
+#define IS_CLOSURE(value) isObjType(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value) isObjType(value, OBJ_FUNCTION)
 #define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
+#define IS_ROPE(value) isObjType(value, OBJ_ROPE)
+#define IS_FIBER(value) isObjType(value, OBJ_FIBER)
+#define IS_TEXT(value) (IS_STRING(value) || IS_ROPE(value)) //문자열 연산(+)을 받는 값: 평평한 문자열 또는 rope
 //올바른 ObjString 포인터를 포함하리라 예상하는 Value를 인수로 받음
 
 #define AS_CLOSURE(value) ((ObjClosure *)AS_OBJ(value))
@@ -18,17 +21,22 @@
 #define AS_NATIVE(value) (((ObjNative *)AS_OBJ(value))->function)
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
+#define AS_ROPE(value) ((ObjRope*)AS_OBJ(value))
+#define AS_FIBER(value) ((ObjFiber*)AS_OBJ(value))
 
 typedef enum {
     OBJ_CLOSURE,
     OBJ_FUNCTION,
     OBJ_NATIVE,
     OBJ_STRING,
+    OBJ_ROPE,
     OBJ_UPVALUE,
+    OBJ_FIBER, //스냅샷 형식의 type 값이 바뀌지 않도록 새 타입은 뒤에 붙인다
 } ObjType;
 
 struct Obj {
     ObjType type;
+    bool isMarked; //GC mark 단계에서 도달 가능한 객체 표시
     Obj *pNext;
 };
 
@@ -36,11 +44,19 @@ typedef struct {
     Obj obj;
     int arity;
     int upValueCount;
+    int maxSlots; //지역 변수 + 호출 인자가 동시에 차지하는 최대 스택 슬롯 수 (call()의 스택 overflow 검사용)
     Chunk chunk;
     ObjString *name;
+    struct LazyFunction *lazy; //NULL이 아니면 아직 컴파일하지 않은 본문 (--lazy). 처음 호출될 때 컴파일한다
 } ObjFunction;
 
-typedef Value (*NativeFn)(int argCount, Value *args);
+typedef enum {
+    NATIVE_RETURN, //반환값을 args[-1](호출된 native의 자리)에 썼다
+    NATIVE_SWITCH, //다른 fiber로 전환했다. 양쪽 스택은 native가 이미 정리했다
+    NATIVE_ERROR, //runtimeError로 에러를 보고했다
+} NativeResult;
+
+typedef NativeResult (*NativeFn)(int argCount, Value *args);
 
 typedef struct {
     Obj obj;
@@ -51,10 +67,28 @@ struct ObjString {
     //첫 번째 필드를 Obj로 만들어서 모든 Obj가 공유하는 상태를 만듦
     Obj obj;
     int length;
-    char *chars;
     uint32_t hash; // cash 고려 각 ObjString마다 자기 문자열의 해시 코드를 저장 하고 즉시 캐시함 O(n)
+#ifdef LAZY_INTERN
+    bool isInterned; //false면 런타임에 만든 문자열: hash는 아직 계산 전(0)일 수 있고 같은 내용의 다른 객체가 있을 수 있다
+#endif
+    char chars[]; //flexible array member: 헤더와 문자(+ '\0')를 한 번에 할당해서 비교할 때 같은 cache line에서 읽는다
 };
 
+#define STRING_SIZE(length) (offsetof(ObjString, chars) + (length) + 1)
+
+//ROPE_MIN_LENGTH 이상인 문자열 연결은 복사하지 않고 두 조각을 가리키는 rope 노드만 만든다.
+//반복해서 이어 붙여도 매번 전체를 복사/해싱하지 않으므로 N조각 문자열 생성이 O(N)이 된다.
+//문자가 필요해지는 시점(비교, 출력)에 한 번만 flatten해서 인터닝하고 결과를 캐시한다
+#define ROPE_MIN_LENGTH 64
+
+typedef struct {
+    Obj obj;
+    int length;
+    Obj *left; //ObjString 또는 ObjRope
+    Obj *right;
+    ObjString *flat; //flatten된 결과. 채워지면 left/right는 NULL이 되어 조각들을 GC가 회수할 수 있다
+} ObjRope;
+
 typedef struct ObjUpValue {
     Obj obj;
     Value* location;
@@ -65,23 +99,66 @@ typedef struct ObjUpValue {
 typedef struct {
     Obj obj;
     ObjFunction* function;
-    ObjUpValue** upValues;
     int upValueCount;
+    ObjUpValue* upValues[]; //flexible array member: 클로저 헤더와 upvalue 배열을 한 번에 할당한다
 }ObjClosure;
 
+typedef enum {
+    FIBER_NEW, //아직 resume된 적 없음: 스택에는 함수만 있다
+    FIBER_SUSPENDED, //yield로 멈춤
+    FIBER_RUNNING, //실행 중이거나, 다른 fiber를 resume하고 그것이 돌아오기를 기다리는 중
+    FIBER_DONE, //함수가 반환했거나 런타임 에러로 끝남
+} FiberState;
+
+//fiber 하나의 실행 상태. 실행 중인 fiber의 상태는 VM의 같은 이름 필드에 풀어두고 전환할 때만 여기에 저장한다
+typedef struct {
+    struct CallFrame *frames;
+    int frameCount;
+    int frameCapacity;
+    Value *stack;
+    Value *stackTop;
+    int stackCapacity;
+    ObjUpValue *openUpValues; //이 fiber의 스택을 가리키는 열린 upvalue들
+} FiberStack;
+
+typedef struct ObjFiber {
+    Obj obj;
+    FiberState state;
+    struct ObjFiber *caller; //이 fiber를 resume한 fiber (NULL이면 메인 스크립트). yield하거나 끝나면 여기로 돌아간다
+    FiberStack saved; //실행 중이 아닐 때의 스택. 실행 중인 동안의 내용은 낡은 값이다
+} ObjFiber;
+
 ObjFunction *newFunction();
 
 ObjNative *newNative(NativeFn function);
 
-ObjString *takeString(char *chars, int length);
+uint32_t hashString(const char *key, int length);
+
+ObjString *allocateString(int length);
+
+ObjString *internString(ObjString *string);
+
+ObjString *finishString(ObjString *string);
+
+#ifdef LAZY_INTERN
+bool stringsEqual(ObjString *a, ObjString *b);
+#endif
 
 ObjString *copyString(const char *chars, int length);
 
+ObjRope *newRope(Obj *left, Obj *right, int length);
+
+void copyRope(ObjRope *rope, char *dest);
+
+ObjString *flattenRope(ObjRope *rope);
+
 ObjUpValue *newUpValue(Value* slot);
 
 ObjClosure *newClosure(ObjFunction *function);
 
-void printObject(Value value);
+ObjFiber *newFiber(ObjClosure *closure);
+
+void printObject(FILE *out, Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
@@ -1,13 +1,6 @@
 #include "scanner.h"
 
-typedef struct {
-    const char *start;
-    const char *current;
-    int line;
-    int interpolationDepth;
-} Scanner;
-
-Scanner scanner;
+_Thread_local Scanner scanner;
 
 static bool isAtEnd() {
     return *scanner.current == '\0';
@@ -242,6 +235,14 @@ void initScanner(const char *source) {
     scanner.line = 1;
 }
 
+Scanner saveScanner() {
+    return scanner;
+}
+
+void restoreScanner(Scanner state) {
+    scanner = state;
+}
+
 static bool isAlpha(char c) {
     return (c >= 'a' && c <= 'z') ||
            (c >= 'A' && c <= 'Z') ||
@@ -36,8 +36,20 @@ typedef struct {
     int line;
 } Token;
 
+typedef struct {
+    const char *start;
+    const char *current;
+    int line;
+    int interpolationDepth;
+} Scanner;
+
 void initScanner(const char *source);
 
+//컴파일러가 같은 소스 구간을 다시 읽을 때 (wide 점프로 함수를 재컴파일) 위치를 저장하고 되돌린다
+Scanner saveScanner();
+
+void restoreScanner(Scanner state);
+
 Token scanToken();
 
 static bool isDigit(char c);
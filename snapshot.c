@@ -0,0 +1,758 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "bytecode.h"
+#include "memory.h"
+#include "vm.h"
+
+//파일 구조 (기록한 기계의 byte order와 구조체 배치를 그대로 쓴다. 같은 빌드 설정으로 만든 파일만 불러올 수 있다):
+//  SnapshotHeader
+//  u32 객체 offset x objectCount (오름차순)
+//  heap: 객체들을 메모리에서의 모습 그대로 16바이트 경계에 맞춰 나열한다. 포인터 필드와 Value에는 파일 안의 offset이 들어 있다
+//        (0 = NULL). 함수는 구조체 바로 뒤에 code, lines, 상수 배열을 붙인다
+//  인터닝 테이블: u32 hashes[stringCapacity], u32 keys[stringCapacity]
+//  전역 이름 테이블: u32 keys[tableCapacity], u32 hashes[..], Value values[..], u8 consts[..]
+//  전역 슬롯: Value values[globalCount], SnapshotGlobal vars[globalCount]
+//불러올 때는 객체 목록을 한 번 훑으면서 포인터 필드에 mmap한 주소를 더한다(relocation). hash seed를 같이 저장하므로 문자열의
+//hash와 두 해시 테이블의 버킷 배치가 그대로 유효하다: 다시 해싱하거나 삽입하지 않고 배열을 복사만 한다.
+//이미지 객체는 항상 mark된 상태로 두어 GC가 건너뛰고, vm.objects에 연결하지 않으므로 해제되지도 않는다
+
+#define OBJECT_ALIGNMENT 16
+#define ALIGN(size, alignment) (((size) + (alignment) - 1) & ~(size_t) ((alignment) - 1))
+#define ALLOW_NULL (1u << 31) //relocate(): NULL 포인터를 허용한다
+#define TEXT_TYPES (1u << OBJ_STRING | 1u << OBJ_ROPE)
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t bytecodeVersion; //함수의 code는 명령어 집합에 묶여 있다
+    uint32_t layout; //객체 배치에 영향을 주는 빌드 설정 (snapshotLayout())
+    uint64_t hashSeed; //문자열 hash를 계산한 seed. 불러오는 VM이 이 seed를 이어받는다
+    uint64_t heapSize;
+    uint32_t objectCount;
+    uint32_t stringCapacity;
+    uint32_t stringCount;
+    uint32_t tableCapacity;
+    uint32_t tableCount;
+    uint32_t globalCount;
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t name;
+    uint32_t isConst;
+} SnapshotGlobal;
+
+typedef struct {
+    //파일 안의 각 영역의 시작 offset (헤더의 개수들로 정해진다)
+    size_t objects;
+    size_t heap;
+    size_t stringHashes;
+    size_t stringKeys;
+    size_t tableKeys;
+    size_t tableHashes;
+    size_t tableValues;
+    size_t tableConsts;
+    size_t globalValues;
+    size_t globalVars;
+    size_t size;
+} Sections;
+
+typedef struct {
+    //함수 객체 안에서 구조체 뒤에 붙는 배열들의 offset
+    size_t code;
+    size_t lines;
+    size_t constants;
+    size_t size;
+} FunctionLayout;
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    uint32_t *objects; //이미지 객체들의 offset (mmap 안)
+    uint32_t objectCount;
+    Obj **mutables; //실행 중에 heap 객체를 가리키게 될 수 있는 이미지 객체들 (upvalue, rope)
+    int mutableCount;
+} Snapshot;
+
+static const char SNAPSHOT_MAGIC[4] = {'L', 'O', 'X', 'S'};
+
+static _Thread_local Snapshot loaded;
+
+static uint32_t snapshotLayout() {
+    uint32_t layout = (uint32_t) sizeof(Value) | (uint32_t) sizeof(void *) << 8;
+#ifdef NAN_BOXING
+    layout |= 1u << 16;
+#endif
+#ifdef LAZY_INTERN
+    layout |= 1u << 17;
+#endif
+    return layout;
+}
+
+static Sections sectionsFor(SnapshotHeader *header) {
+    Sections sections;
+    sections.objects = sizeof(SnapshotHeader);
+    sections.heap = ALIGN(sections.objects + sizeof(uint32_t) * header->objectCount, OBJECT_ALIGNMENT);
+    sections.stringHashes = sections.heap + header->heapSize;
+    sections.stringKeys = sections.stringHashes + sizeof(uint32_t) * header->stringCapacity;
+    sections.tableKeys = sections.stringKeys + sizeof(uint32_t) * header->stringCapacity;
+    sections.tableHashes = sections.tableKeys + sizeof(uint32_t) * header->tableCapacity;
+    sections.tableValues = ALIGN(sections.tableHashes + sizeof(uint32_t) * header->tableCapacity, 8);
+    sections.tableConsts = sections.tableValues + sizeof(Value) * header->tableCapacity;
+    sections.globalValues = ALIGN(sections.tableConsts + header->tableCapacity, 8);
+    sections.globalVars = sections.globalValues + sizeof(Value) * header->globalCount;
+    sections.size = sections.globalVars + sizeof(SnapshotGlobal) * header->globalCount;
+    return sections;
+}
+
+static FunctionLayout functionLayout(int codeCount, int constantCount) {
+    FunctionLayout layout;
+    layout.code = ALIGN(sizeof(ObjFunction), 8);
+    layout.lines = ALIGN(layout.code + (size_t) codeCount, 8);
+    layout.constants = ALIGN(layout.lines + sizeof(int) * (size_t) codeCount, 8);
+    layout.size = layout.constants + sizeof(Value) * (size_t) constantCount;
+    return layout;
+}
+
+static size_t objectSize(Obj *object) {
+    switch (object->type) {
+        case OBJ_CLOSURE:
+            return sizeof(ObjClosure) + sizeof(ObjUpValue *) * ((ObjClosure *) object)->upValueCount;
+        case OBJ_FUNCTION: {
+            ObjFunction *function = (ObjFunction *) object;
+            return functionLayout(function->chunk.count, function->chunk.constants.count).size;
+        }
+        case OBJ_NATIVE:
+            return sizeof(ObjNative);
+        case OBJ_STRING:
+            return STRING_SIZE(((ObjString *) object)->length);
+        case OBJ_ROPE:
+            return sizeof(ObjRope);
+        case OBJ_UPVALUE:
+            return sizeof(ObjUpValue);
+        case OBJ_FIBER:
+            return sizeof(ObjFiber); //writeObject가 거부한다
+    }
+    return 0;
+}
+
+//쓰기 ---------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    Obj **objects; //저장할 객체들: heap(vm.objects 순서) 다음에 이미 불러온 이미지의 객체들
+    int count;
+    int heapCount;
+    uint8_t *bytes; //파일 전체
+    const char *error;
+} SnapshotWriter;
+
+static uint32_t imageOffset(void *object) {
+    //쓰는 동안 각 객체의 pNext에는 그 객체의 파일 offset이 들어 있다 (끝나면 연결을 되돌린다)
+    return object == NULL ? 0 : (uint32_t) (uintptr_t) ((Obj *) object)->pNext;
+}
+
+static void *imagePointer(void *object) {
+    return (void *) (uintptr_t) imageOffset(object);
+}
+
+static Value imageValue(Value value) {
+    return IS_OBJ(value) ? OBJ_VAL(imagePointer(AS_OBJ(value))) : value;
+}
+
+static void addObject(SnapshotWriter *writer, Obj *object, int *capacity) {
+    //GC가 돌지 않도록 reallocate()가 아닌 realloc()으로 관리한다
+    if (writer->count + 1 > *capacity) {
+        *capacity = GROW_CAPACITY(*capacity);
+        writer->objects = (Obj **) realloc(writer->objects, sizeof(Obj *) * *capacity);
+        if (writer->objects == NULL) exit(1);
+    }
+    writer->objects[writer->count++] = object;
+}
+
+static bool writeObject(SnapshotWriter *writer, Obj *object) {
+    uint32_t offset = imageOffset(object);
+    uint8_t *dest = writer->bytes + offset;
+    switch (object->type) {
+        case OBJ_CLOSURE: {
+            ObjClosure *closure = (ObjClosure *) dest;
+            memcpy(dest, object, objectSize(object));
+            closure->function = imagePointer(closure->function);
+            for (int i = 0; i < closure->upValueCount; i++) {
+                closure->upValues[i] = imagePointer(closure->upValues[i]);
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction *source = (ObjFunction *) object;
+            ObjFunction *function = (ObjFunction *) dest;
+            if (source->lazy != NULL) {
+                writer->error = "Function body is not compiled (--lazy).";
+                return false;
+            }
+            Chunk *chunk = &source->chunk;
+            FunctionLayout layout = functionLayout(chunk->count, chunk->constants.count);
+            memcpy(dest, object, sizeof(ObjFunction));
+            memcpy(dest + layout.code, chunk->code, chunk->count);
+            memcpy(dest + layout.lines, chunk->lines, sizeof(int) * chunk->count);
+            Value *constants = (Value *) (dest + layout.constants);
+            for (int i = 0; i < chunk->constants.count; i++) {
+                constants[i] = imageValue(chunk->constants.values[i]);
+            }
+            //배열의 위치는 layout으로 정해지므로 포인터는 불러올 때 다시 계산한다
+            function->name = imagePointer(source->name);
+            function->chunk.code = NULL;
+            function->chunk.lines = NULL;
+            function->chunk.capacity = chunk->count;
+            function->chunk.ownsCode = false;
+            function->chunk.constants.values = NULL;
+            function->chunk.constants.capacity = chunk->constants.count;
+            break;
+        }
+        case OBJ_NATIVE: {
+            NativeFn native = ((ObjNative *) object)->function;
+            int index = 0;
+            while (index < nativeCount && natives[index].function != native) index++;
+            if (index == nativeCount) {
+                writer->error = "Unknown native function.";
+                return false;
+            }
+            memcpy(dest, object, sizeof(ObjNative));
+            ((ObjNative *) dest)->function = (NativeFn) (uintptr_t) index;
+            break;
+        }
+        case OBJ_STRING:
+            memcpy(dest, object, objectSize(object));
+            break;
+        case OBJ_ROPE: {
+            ObjRope *rope = (ObjRope *) dest;
+            memcpy(dest, object, sizeof(ObjRope));
+            rope->left = imagePointer(rope->left);
+            rope->right = imagePointer(rope->right);
+            rope->flat = imagePointer(rope->flat);
+            break;
+        }
+        case OBJ_UPVALUE: {
+            ObjUpValue *source = (ObjUpValue *) object;
+            ObjUpValue *upValue = (ObjUpValue *) dest;
+            if (source->location != &source->closed) {
+                writer->error = "Cannot snapshot an open upvalue.";
+                return false;
+            }
+            memcpy(dest, object, sizeof(ObjUpValue));
+            upValue->location = (Value *) (uintptr_t) (offset + offsetof(ObjUpValue, closed));
+            upValue->closed = imageValue(source->closed);
+            upValue->pNext = NULL;
+            break;
+        }
+        case OBJ_FIBER:
+            writer->error = "Cannot snapshot a fiber.";
+            return false;
+    }
+    ((Obj *) dest)->isMarked = true;
+    ((Obj *) dest)->pNext = NULL;
+    return true;
+}
+
+static bool buildImage(SnapshotWriter *writer, SnapshotHeader *header) {
+    Sections sections = sectionsFor(header);
+    writer->bytes = calloc(sections.size, 1);
+    if (writer->bytes == NULL) exit(1);
+    memcpy(writer->bytes, header, sizeof(SnapshotHeader));
+
+    uint32_t *offsets = (uint32_t *) (writer->bytes + sections.objects);
+    for (int i = 0; i < writer->count; i++) {
+        offsets[i] = imageOffset(writer->objects[i]);
+        if (!writeObject(writer, writer->objects[i])) return false;
+    }
+
+    uint32_t *stringHashes = (uint32_t *) (writer->bytes + sections.stringHashes);
+    uint32_t *stringKeys = (uint32_t *) (writer->bytes + sections.stringKeys);
+    for (int i = 0; i < vm.strings.capacity; i++) {
+        stringHashes[i] = vm.strings.hashes[i];
+        stringKeys[i] = imageOffset(vm.strings.keys[i]);
+    }
+
+    Table *slots = &vm.globals.slots;
+    uint32_t *tableKeys = (uint32_t *) (writer->bytes + sections.tableKeys);
+    uint32_t *tableHashes = (uint32_t *) (writer->bytes + sections.tableHashes);
+    Value *tableValues = (Value *) (writer->bytes + sections.tableValues);
+    uint8_t *tableConsts = writer->bytes + sections.tableConsts;
+    for (int i = 0; i < slots->capacity; i++) {
+        if (slots->keys[i] == NULL) continue;
+        tableKeys[i] = imageOffset(slots->keys[i]);
+        tableHashes[i] = slots->hashes[i];
+        tableValues[i] = slots->values[i];
+        tableConsts[i] = slots->consts[i];
+    }
+
+    Value *globalValues = (Value *) (writer->bytes + sections.globalValues);
+    SnapshotGlobal *globalVars = (SnapshotGlobal *) (writer->bytes + sections.globalVars);
+    for (int i = 0; i < vm.globals.vars.count; i++) {
+        GlobalVar *var = &READ_AS(GlobalVar, &vm.globals.vars, i);
+        globalValues[i] = imageValue(vm.globals.values.values[i]);
+        globalVars[i].name = imageOffset(var->name);
+        globalVars[i].isConst = var->isConst;
+    }
+    return true;
+}
+
+static bool writeFile(const char *path, const void *bytes, size_t size) {
+    //임시 파일에 다 쓴 뒤 rename한다 (writeBytecode와 같은 방식)
+    size_t pathLength = strlen(path);
+    char *tempPath = malloc(pathLength + 5);
+    memcpy(tempPath, path, pathLength);
+    memcpy(tempPath + pathLength, ".tmp", 5);
+
+    FILE *file = fopen(tempPath, "wb");
+    bool ok = file != NULL && fwrite(bytes, 1, size, file) == size;
+    if (file != NULL) ok = fclose(file) == 0 && ok;
+    ok = ok && rename(tempPath, path) == 0;
+    if (!ok) remove(tempPath);
+    free(tempPath);
+    return ok;
+}
+
+bool writeSnapshot(const char *path, const char **error) {
+    //웜업이 끝난 뒤(스택이 비어 있을 때) 호출한다. 수집 후 vm.objects에 남은 객체는 모두 도달 가능하고,
+    //인터닝 테이블(weak)에도 살아 있는 문자열만 남는다
+    collectGarbage();
+
+    SnapshotWriter writer = {0};
+    int capacity = 0;
+    for (Obj *object = vm.objects; object != NULL; object = object->pNext) {
+        addObject(&writer, object, &capacity);
+    }
+    writer.heapCount = writer.count;
+    for (uint32_t i = 0; i < loaded.objectCount; i++) {
+        addObject(&writer, (Obj *) (loaded.base + loaded.objects[i]), &capacity);
+    }
+
+    SnapshotHeader header = {
+        .version = SNAPSHOT_VERSION,
+        .bytecodeVersion = BYTECODE_VERSION,
+        .layout = snapshotLayout(),
+        .hashSeed = vm.hashSeed,
+        .objectCount = (uint32_t) writer.count,
+        .stringCapacity = (uint32_t) vm.strings.capacity,
+        .stringCount = (uint32_t) vm.strings.count,
+        .tableCapacity = (uint32_t) vm.globals.slots.capacity,
+        .tableCount = (uint32_t) vm.globals.slots.count,
+        .globalCount = (uint32_t) vm.globals.vars.count,
+    };
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+
+    //객체마다 파일 offset을 정해서 pNext에 넣어둔다
+    size_t offset = sectionsFor(&header).heap;
+    size_t heapStart = offset;
+    for (int i = 0; i < writer.count; i++) {
+        writer.objects[i]->pNext = (Obj *) (uintptr_t) offset;
+        offset += ALIGN(objectSize(writer.objects[i]), OBJECT_ALIGNMENT);
+    }
+    header.heapSize = offset - heapStart;
+
+    bool ok = false;
+    if (sectionsFor(&header).size > UINT32_MAX) {
+        writer.error = "Heap is too large for a snapshot.";
+    } else if (buildImage(&writer, &header)) {
+        ok = writeFile(path, writer.bytes, sectionsFor(&header).size);
+        if (!ok) writer.error = "Could not write snapshot file.";
+    }
+
+    //객체 연결을 되돌린다. 이미지 객체는 어떤 리스트에도 속하지 않는다
+    for (int i = 0; i < writer.count; i++) {
+        writer.objects[i]->pNext = i + 1 < writer.heapCount ? writer.objects[i + 1] : NULL;
+    }
+    free(writer.objects);
+    free(writer.bytes);
+    if (!ok) *error = writer.error;
+    return ok;
+}
+
+//불러오기 -----------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    Sections sections;
+    uint32_t *objects;
+    uint32_t objectCount;
+    uint8_t *starts; //heap의 16바이트 칸마다 객체가 시작하는지 (포인터 검사를 O(1)로)
+    const char *error;
+} Loader;
+
+static bool fail(Loader *loader, const char *error) {
+    if (loader->error == NULL) loader->error = error;
+    return false;
+}
+
+static Obj *objectAt(Loader *loader, uint64_t offset) {
+    //offset이 이미지 객체의 시작이면 그 객체, 아니면 NULL
+    uint64_t heapSize = ((SnapshotHeader *) loader->base)->heapSize;
+    if (offset < loader->sections.heap || offset - loader->sections.heap >= heapSize ||
+        offset % OBJECT_ALIGNMENT != 0) {
+        return NULL;
+    }
+    uint64_t slot = (offset - loader->sections.heap) / OBJECT_ALIGNMENT;
+    if (!(loader->starts[slot / 8] & 1u << slot % 8)) return NULL;
+    return (Obj *) (loader->base + offset);
+}
+
+static bool relocate(Loader *loader, void *field, uint32_t types) {
+    //field: 파일 offset이 들어 있는 포인터 필드. types에 속한 객체를 가리키면 실제 주소로 바꾼다
+    uintptr_t offset;
+    memcpy(&offset, field, sizeof(offset));
+    if (offset == 0) return (types & ALLOW_NULL) != 0 || fail(loader, "Unexpected null reference.");
+    Obj *object = objectAt(loader, offset);
+    if (object == NULL || !(types & 1u << object->type)) return fail(loader, "Invalid object reference.");
+    memcpy(field, &object, sizeof(object));
+    return true;
+}
+
+static bool relocateValue(Loader *loader, Value *value) {
+    if (!IS_OBJ(*value)) return true;
+    Obj *object = objectAt(loader, (uintptr_t) AS_OBJ(*value));
+    if (object == NULL || object->type == OBJ_UPVALUE) return fail(loader, "Invalid value reference.");
+    *value = OBJ_VAL(object);
+    return true;
+}
+
+static bool checkObject(Loader *loader, uint32_t index) {
+    //객체의 타입과 크기가 다음 객체(또는 heap 끝) 전까지 들어가는지 확인한다
+    size_t offset = loader->objects[index];
+    size_t heapEnd = loader->sections.heap + ((SnapshotHeader *) loader->base)->heapSize;
+    if (offset < loader->sections.heap || offset % OBJECT_ALIGNMENT != 0 || offset >= heapEnd ||
+        (index > 0 && offset <= loader->objects[index - 1])) {
+        return fail(loader, "Invalid object offset.");
+    }
+    size_t slot = (offset - loader->sections.heap) / OBJECT_ALIGNMENT;
+    loader->starts[slot / 8] |= (uint8_t) (1u << slot % 8);
+    size_t limit = (index + 1 < loader->objectCount ? loader->objects[index + 1] : heapEnd) - offset;
+    if (limit < sizeof(Obj)) return fail(loader, "Truncated object.");
+
+    Obj *object = (Obj *) (loader->base + offset);
+    int type = (int) object->type;
+    if (type < OBJ_CLOSURE || type > OBJ_UPVALUE) return fail(loader, "Unknown object type.");
+    size_t fixed[] = {
+        [OBJ_CLOSURE] = sizeof(ObjClosure), [OBJ_FUNCTION] = sizeof(ObjFunction), [OBJ_NATIVE] = sizeof(ObjNative),
+        [OBJ_STRING] = sizeof(ObjString), [OBJ_ROPE] = sizeof(ObjRope), [OBJ_UPVALUE] = sizeof(ObjUpValue),
+    };
+    if (limit < fixed[type]) return fail(loader, "Truncated object.");
+    switch (object->type) {
+        case OBJ_CLOSURE:
+            if (((ObjClosure *) object)->upValueCount < 0) return fail(loader, "Invalid closure.");
+            break;
+        case OBJ_FUNCTION: {
+            ObjFunction *function = (ObjFunction *) object;
+            if (function->chunk.count <= 0 || function->chunk.constants.count < 0 || function->arity < 0 ||
+                function->upValueCount < 0 || function->maxSlots < 0) {
+                return fail(loader, "Invalid function.");
+            }
+            break;
+        }
+        case OBJ_NATIVE: {
+            uintptr_t native = (uintptr_t) ((ObjNative *) object)->function;
+            if (native >= (uintptr_t) nativeCount) return fail(loader, "Unknown native function.");
+            break;
+        }
+        case OBJ_STRING:
+            if (((ObjString *) object)->length < 0) return fail(loader, "Invalid string.");
+            break;
+        case OBJ_ROPE:
+        case OBJ_UPVALUE:
+            break;
+        case OBJ_FIBER: //writeSnapshot이 fiber가 남은 힙은 거부하므로 이미지에 있을 수 없다
+            return fail(loader, "Unknown object type.");
+    }
+    if (objectSize(object) > limit) return fail(loader, "Truncated object.");
+    if (object->type == OBJ_STRING && ((ObjString *) object)->chars[((ObjString *) object)->length] != '\0') {
+        return fail(loader, "Invalid string.");
+    }
+    return true;
+}
+
+static int textLength(Obj *text) {
+    return text->type == OBJ_ROPE ? ((ObjRope *) text)->length : ((ObjString *) text)->length;
+}
+
+static bool relocateObject(Loader *loader, Obj *object) {
+    object->isMarked = true; //항상 mark된 상태: GC는 이미지 객체를 따라가지도, 해제하지도 않는다
+    object->pNext = NULL;
+    switch (object->type) {
+        case OBJ_CLOSURE: {
+            ObjClosure *closure = (ObjClosure *) object;
+            if (!relocate(loader, &closure->function, 1u << OBJ_FUNCTION)) return false;
+            if (closure->upValueCount != closure->function->upValueCount) return fail(loader, "Invalid closure.");
+            for (int i = 0; i < closure->upValueCount; i++) {
+                if (!relocate(loader, &closure->upValues[i], 1u << OBJ_UPVALUE)) return false;
+            }
+            return true;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction *function = (ObjFunction *) object;
+            Chunk *chunk = &function->chunk;
+            FunctionLayout layout = functionLayout(chunk->count, chunk->constants.count);
+            //code와 lines는 이미지를 빌려 쓴다 (.loxc처럼 ownsCode = false). quickening은 MAP_PRIVATE 페이지를 고쳐 쓴다
+            chunk->code = (uint8_t *) object + layout.code;
+            chunk->lines = (int *) ((uint8_t *) object + layout.lines);
+            chunk->capacity = chunk->count;
+            chunk->ownsCode = false;
+            chunk->constants.values = chunk->constants.count > 0 ? (Value *) ((uint8_t *) object + layout.constants)
+                                                                 : NULL;
+            chunk->constants.capacity = chunk->constants.count;
+            function->lazy = NULL;
+            if (!relocate(loader, &function->name, 1u << OBJ_STRING | ALLOW_NULL)) return false;
+            for (int i = 0; i < chunk->constants.count; i++) {
+                if (!relocateValue(loader, &chunk->constants.values[i])) return false;
+            }
+            return true;
+        }
+        case OBJ_NATIVE: {
+            ObjNative *native = (ObjNative *) object;
+            native->function = natives[(uintptr_t) native->function].function;
+            return true;
+        }
+        case OBJ_STRING:
+            return true;
+        case OBJ_ROPE: {
+            ObjRope *rope = (ObjRope *) object;
+            if (!relocate(loader, &rope->left, TEXT_TYPES | ALLOW_NULL) ||
+                !relocate(loader, &rope->right, TEXT_TYPES | ALLOW_NULL) ||
+                !relocate(loader, &rope->flat, 1u << OBJ_STRING | ALLOW_NULL)) {
+                return false;
+            }
+            //조각은 rope보다 먼저 만들어지므로 (vm.objects에서 뒤에 있으므로) 항상 더 큰 offset에 있다. 그래서 순환이 없다
+            if (rope->flat != NULL) return rope->flat->length == rope->length || fail(loader, "Invalid rope.");
+            if (rope->left == NULL || rope->right == NULL ||
+                (rope->left->type == OBJ_ROPE && rope->left <= object) ||
+                (rope->right->type == OBJ_ROPE && rope->right <= object) ||
+                (int64_t) textLength(rope->left) + textLength(rope->right) != rope->length) {
+                return fail(loader, "Invalid rope.");
+            }
+            return true;
+        }
+        case OBJ_UPVALUE: {
+            ObjUpValue *upValue = (ObjUpValue *) object;
+            upValue->location = &upValue->closed; //이미지의 upvalue는 항상 닫혀 있다
+            upValue->pNext = NULL;
+            return relocateValue(loader, &upValue->closed);
+        }
+        case OBJ_FIBER:
+            return fail(loader, "Unknown object type.");
+    }
+    return false;
+}
+
+static bool isTableCapacity(uint32_t capacity) {
+    //Robin Hood 테이블의 capacity는 0 또는 2의 거듭제곱이다
+    return (capacity & (capacity - 1)) == 0 && capacity <= INT_MAX;
+}
+
+static bool readImage(Loader *loader) {
+    if (loader->size < sizeof(SnapshotHeader)) return fail(loader, "Truncated snapshot file.");
+    SnapshotHeader *header = (SnapshotHeader *) loader->base;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        return fail(loader, "Not a snapshot file.");
+    }
+    if (header->version != SNAPSHOT_VERSION || header->bytecodeVersion != BYTECODE_VERSION) {
+        return fail(loader, "Snapshot version mismatch.");
+    }
+    if (header->layout != snapshotLayout()) return fail(loader, "Snapshot was written by a different build.");
+    if (header->heapSize > loader->size) return fail(loader, "Truncated snapshot file.");
+    loader->sections = sectionsFor(header);
+    if (loader->sections.size != loader->size) return fail(loader, "Snapshot size mismatch.");
+    if (!isTableCapacity(header->stringCapacity) || !isTableCapacity(header->tableCapacity)) {
+        return fail(loader, "Invalid table capacity.");
+    }
+    if (header->stringCount > header->stringCapacity || header->tableCount > header->tableCapacity ||
+        header->globalCount > UINT16_COUNT) {
+        return fail(loader, "Invalid snapshot header.");
+    }
+
+    loader->objects = (uint32_t *) (loader->base + loader->sections.objects);
+    loader->objectCount = header->objectCount;
+    loader->starts = calloc(header->heapSize / OBJECT_ALIGNMENT / 8 + 1, 1);
+    if (loader->starts == NULL) exit(1);
+    for (uint32_t i = 0; i < loader->objectCount; i++) {
+        if (!checkObject(loader, i)) return false;
+    }
+    for (uint32_t i = 0; i < loader->objectCount; i++) {
+        if (!relocateObject(loader, (Obj *) (loader->base + loader->objects[i]))) return false;
+    }
+    //명령어는 .loxc와 같은 검사를 거친다 (상수가 가리키는 함수가 모두 relocate된 뒤에)
+    for (uint32_t i = 0; i < loader->objectCount; i++) {
+        Obj *object = (Obj *) (loader->base + loader->objects[i]);
+        if (object->type == OBJ_FUNCTION &&
+            !verifyBytecode((ObjFunction *) object, (int) header->globalCount, &loader->error)) {
+            return false;
+        }
+    }
+
+    //테이블의 key와 값도 미리 확인/relocate해둔다 (아래에서 VM으로 옮길 때는 실패하지 않는다)
+    uint32_t *stringKeys = (uint32_t *) (loader->base + loader->sections.stringKeys);
+    uint32_t *stringHashes = (uint32_t *) (loader->base + loader->sections.stringHashes);
+    for (uint32_t i = 0; i < header->stringCapacity; i++) {
+        if (stringKeys[i] == 0) continue;
+        Obj *key = objectAt(loader, stringKeys[i]);
+        if (key == NULL || key->type != OBJ_STRING || ((ObjString *) key)->hash != stringHashes[i]) {
+            return fail(loader, "Invalid interned string.");
+        }
+    }
+    uint32_t *tableKeys = (uint32_t *) (loader->base + loader->sections.tableKeys);
+    Value *tableValues = (Value *) (loader->base + loader->sections.tableValues);
+    for (uint32_t i = 0; i < header->tableCapacity; i++) {
+        if (tableKeys[i] == 0) continue;
+        Obj *key = objectAt(loader, tableKeys[i]);
+        if (key == NULL || key->type != OBJ_STRING || !IS_NUMBER(tableValues[i]) ||
+            !(AS_NUMBER(tableValues[i]) >= 0 && AS_NUMBER(tableValues[i]) < header->globalCount)) {
+            return fail(loader, "Invalid global table entry.");
+        }
+    }
+    Value *globalValues = (Value *) (loader->base + loader->sections.globalValues);
+    SnapshotGlobal *globalVars = (SnapshotGlobal *) (loader->base + loader->sections.globalVars);
+    for (uint32_t i = 0; i < header->globalCount; i++) {
+        Obj *name = objectAt(loader, globalVars[i].name);
+        if (name == NULL || name->type != OBJ_STRING) return fail(loader, "Invalid global name.");
+        if (!relocateValue(loader, &globalValues[i])) return false;
+    }
+    return true;
+}
+
+static void installImage(Loader *loader) {
+    //새 배열을 모두 할당한 뒤에 VM의 배열과 바꾼다. 할당 도중 GC가 돌아도 VM은 항상 온전한 이전 상태를 본다
+    SnapshotHeader *header = (SnapshotHeader *) loader->base;
+    uint8_t *base = loader->base;
+    Sections *sections = &loader->sections;
+
+    StringSet strings;
+    strings.capacity = (int) header->stringCapacity;
+    strings.count = (int) header->stringCount;
+    strings.keys = ALLOCATE(ObjString *, strings.capacity);
+    strings.hashes = ALLOCATE(uint32_t, strings.capacity);
+
+    Table slots;
+    slots.capacity = (int) header->tableCapacity;
+    slots.count = (int) header->tableCount;
+    slots.keys = ALLOCATE(ObjString *, slots.capacity);
+    slots.hashes = ALLOCATE(uint32_t, slots.capacity);
+    slots.values = ALLOCATE(Value, slots.capacity);
+    slots.consts = ALLOCATE(bool, slots.capacity);
+
+    ValueArray values;
+    values.capacity = values.count = (int) header->globalCount;
+    values.values = ALLOCATE(Value, values.capacity);
+
+    Array vars;
+    initArray(&vars, sizeof(GlobalVar));
+    vars.capacity = vars.count = (int) header->globalCount;
+    vars.values = ALLOCATE(GlobalVar, vars.capacity);
+
+    //버킷 배치를 그대로 옮긴다: 이미지의 hash seed를 이어받으므로 다시 해싱하거나 삽입할 필요가 없다
+    uint32_t *stringKeys = (uint32_t *) (base + sections->stringKeys);
+    memcpy(strings.hashes, base + sections->stringHashes, sizeof(uint32_t) * strings.capacity);
+    for (int i = 0; i < strings.capacity; i++) {
+        strings.keys[i] = stringKeys[i] != 0 ? (ObjString *) (base + stringKeys[i]) : NULL;
+    }
+
+    uint32_t *tableKeys = (uint32_t *) (base + sections->tableKeys);
+    memcpy(slots.hashes, base + sections->tableHashes, sizeof(uint32_t) * slots.capacity);
+    memcpy(slots.values, base + sections->tableValues, sizeof(Value) * slots.capacity);
+    for (int i = 0; i < slots.capacity; i++) {
+        slots.keys[i] = tableKeys[i] != 0 ? (ObjString *) (base + tableKeys[i]) : NULL;
+        slots.consts[i] = base[sections->tableConsts + i] != 0;
+    }
+
+    SnapshotGlobal *globalVars = (SnapshotGlobal *) (base + sections->globalVars);
+    memcpy(values.values, base + sections->globalValues, sizeof(Value) * values.capacity);
+    for (int i = 0; i < vars.count; i++) {
+        GlobalVar var = {.name = (ObjString *) (base + globalVars[i].name), .isConst = globalVars[i].isConst != 0};
+        READ_AS(GlobalVar, &vars, i) = var;
+    }
+
+    //initVM이 만든 전역(native)과 문자열은 더 이상 참조되지 않으므로 다음 GC가 치운다
+    freeStringSet(&vm.strings);
+    freeTable(&vm.globals.slots);
+    freeValueArray(&vm.globals.values);
+    freeArray(&vm.globals.vars);
+    vm.strings = strings;
+    vm.globals.slots = slots;
+    vm.globals.values = values;
+    vm.globals.vars = vars;
+    vm.hashSeed = header->hashSeed;
+    for (int i = 0; i < SMALL_INT_STRINGS; i++) {
+        vm.smallIntStrings[i] = NULL; //이전 seed로 만든 (인터닝 테이블에 없는) 문자열이므로 버린다
+    }
+}
+
+bool loadSnapshot(const char *path, const char **error) {
+    if (loaded.base != NULL) {
+        *error = "A snapshot is already loaded.";
+        return false;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *error = "Could not open snapshot file.";
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        *error = "Could not read snapshot file.";
+        return false;
+    }
+    //MAP_PRIVATE: relocation과 실행 중의 변경(upvalue 대입, quickening)은 이 프로세스의 페이지에만 반영된다
+    void *base = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        *error = "Could not map snapshot file.";
+        return false;
+    }
+
+    Loader loader = {.base = base, .size = (size_t) info.st_size};
+    bool ok = readImage(&loader);
+    free(loader.starts);
+    if (!ok) {
+        *error = loader.error;
+        munmap(base, loader.size);
+        return false;
+    }
+    installImage(&loader);
+
+    loaded.base = loader.base;
+    loaded.size = loader.size;
+    loaded.objects = loader.objects;
+    loaded.objectCount = loader.objectCount;
+    loaded.mutables = (Obj **) malloc(sizeof(Obj *) * (loaded.objectCount + 1));
+    if (loaded.mutables == NULL) exit(1);
+    for (uint32_t i = 0; i < loaded.objectCount; i++) {
+        Obj *object = (Obj *) (loaded.base + loaded.objects[i]);
+        if (object->type == OBJ_UPVALUE || object->type == OBJ_ROPE) loaded.mutables[loaded.mutableCount++] = object;
+    }
+    return true;
+}
+
+void markSnapshotRoots() {
+    //이미지 객체는 항상 mark된 상태라 GC가 따라 들어가지 않는다. 함수, 클로저, 문자열은 이미지 안의 객체만 가리키고
+    //바뀌지 않지만, upvalue(대입)와 rope(flatten 결과)는 heap 객체를 가리키게 될 수 있으므로 여기서 직접 훑는다
+    for (int i = 0; i < loaded.mutableCount; i++) {
+        Obj *object = loaded.mutables[i];
+        if (object->type == OBJ_UPVALUE) {
+            markValue(((ObjUpValue *) object)->closed);
+        } else {
+            ObjRope *rope = (ObjRope *) object;
+            markObject(rope->left);
+            markObject(rope->right);
+            markObject((Obj *) rope->flat);
+        }
+    }
+}
+
+void closeSnapshot() {
+    if (loaded.base != NULL) munmap(loaded.base, loaded.size);
+    free(loaded.mutables);
+    memset(&loaded, 0, sizeof(Snapshot));
+}
@@ -0,0 +1,22 @@
+#ifndef CLOX_SNAPSHOT_H
+#define CLOX_SNAPSHOT_H
+
+#include "common.h"
+
+//.loxs: 웜업 스크립트(prelude)를 실행한 뒤의 heap 전체(전역 변수, 인터닝 테이블, 도달 가능한 모든 객체)를 저장한 이미지.
+//형식이나 객체 배치가 바뀌면 올린다
+#define SNAPSHOT_VERSION 2
+
+//GC로 죽은 객체를 치운 뒤 살아 있는 heap을 path에 쓴다. 실패하면 false를 반환하고 *error에 이유를 남긴다
+bool writeSnapshot(const char *path, const char **error);
+
+//initVM 직후, 아무것도 컴파일하기 전에 호출한다. 이미지의 객체들은 mmap한 페이지 안에서 그대로 쓰이고 해제되지 않는다
+bool loadSnapshot(const char *path, const char **error);
+
+//이미지 객체가 가리키는 heap 객체들을 mark한다 (markRoots에서 호출)
+void markSnapshotRoots();
+
+//freeVM이 heap을 모두 해제한 뒤에 이미지를 unmap한다
+void closeSnapshot();
+
+#endif //CLOX_SNAPSHOT_H
@@ -1,142 +1,334 @@
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75
+//Robin Hood hashing: 각 엔트리는 자기 home 버킷(hash & mask)에서 떨어진 거리(probe 거리)를 가진다.
+//삽입할 때 자기보다 home에 가까운(덜 밀려난) 엔트리를 만나면 자리를 빼앗고 그 엔트리를 대신 밀어낸다.
+//그래서 probe 거리가 고르게 유지되고, 조회는 자기보다 거리가 짧은 엔트리를 만나는 순간 멈출 수 있다.
+//삭제는 툼스톤 대신 뒤따르는 엔트리들을 한 칸씩 당기는 backward-shift로 처리한다
+#define HOME(table, hash) ((hash) & ((table)->capacity - 1))
+#define DISTANCE(table, index) (((index) - HOME(table, (table)->hashes[index])) & ((table)->capacity - 1))
 
 void initTable(Table *table) {
     table->count = 0;
     table->capacity = 0;
-    table->entries = NULL;
+    table->keys = NULL;
+    table->hashes = NULL;
+    table->values = NULL;
+    table->consts = NULL;
 }
 
 void freeTable(Table *table) {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(ObjString*, table->keys, table->capacity);
+    FREE_ARRAY(uint32_t, table->hashes, table->capacity);
+    FREE_ARRAY(Value, table->values, table->capacity);
+    FREE_ARRAY(bool, table->consts, table->capacity);
     initTable(table);
 }
 
-Entry *findEntry(Entry *entries, int capacity, ObjString *key) {
-    uint32_t index = key->hash % capacity; // %연산자로 키의 해시 코드를 배열 경계 내부의 인덱스에 매핑
-    Entry* tombstone = NULL;
-    for (;;) { //버킷에 엔트리가 있지만 키가 달라서 해시 충돌이 일어날 경우 -> probing
-        Entry *entry = &entries[index];
-            //엔트리 자체가 없고 엔트리를 삽입하는 용도로 함수를 사용할 경우에는 새 엔트리를 추가할 위치를 찾았다는 뜻
-            // 삽입을 하는 경우에는 새 엔트리를 추가하는 대신 찾은 키의 값을 바꿀 것이다.
-        if(entry->key == NULL){
-            if(IS_NIL(entry->value)){
-                //엔트리를 비운다
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                //툼스톤을 찾은 경우
-                if(tombstone==NULL) tombstone = entry;
-            }
-        } else if (entry->key == key){
-            return entry;
-        }
-        index = (index + 1) % capacity; //배열 끝을 넘어가면 두 번째 나머지 연산자가 처음으로 되돌린다.
+static int findEntry(Table *table, ObjString *key) {
+    //key가 있는 버킷의 인덱스, 없으면 -1
+    uint32_t mask = table->capacity - 1;
+    uint32_t index = key->hash & mask;
+    for (uint32_t distance = 0;; distance++) {
+        ObjString *entryKey = table->keys[index];
+        if (entryKey == key) return (int) index;
+        //빈 버킷이나 나보다 덜 밀려난 엔트리를 만나면 key는 테이블에 없다 (있었다면 그 자리를 차지했을 것)
+        if (entryKey == NULL || DISTANCE(table, index) < distance) return -1;
+        index = (index + 1) & mask;
     }
 }
 
-bool tableGet(Table* table, ObjString* key, Value* value){
-    if(table->count ==0) return false;
+bool tableGet(Table *table, ObjString *key, Value *value) {
+    if (table->count == 0) return false;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if(entry->key == NULL) return false;
+    int index = findEntry(table, key);
+    if (index == -1) return false;
 
-
-    *value =entry->value;
+    *value = table->values[index];
     return true;
 }
 
-static void adjustCapacity(Table *table, int capacity) { // 버킷 배열 할당
-    Entry *entries = ALLOCATE(Entry, capacity);
-    for (int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL;
+static void insertEntry(Table *table, ObjString *key, uint32_t hash, Value value, bool isConst) {
+    //key가 테이블에 없다는 것이 보장된 상태에서 Robin Hood 방식으로 삽입한다
+    uint32_t mask = table->capacity - 1;
+    uint32_t index = hash & mask;
+    uint32_t distance = 0;
+    for (;;) {
+        if (table->keys[index] == NULL) {
+            table->keys[index] = key;
+            table->hashes[index] = hash;
+            table->values[index] = value;
+            table->consts[index] = isConst;
+            return;
+        }
+        uint32_t existing = DISTANCE(table, index);
+        if (existing < distance) {
+            //부자(home에 가까운 엔트리)의 자리를 빼앗고, 밀려난 엔트리를 이어서 삽입한다
+            ObjString *swapKey = table->keys[index];
+            uint32_t swapHash = table->hashes[index];
+            Value swapValue = table->values[index];
+            bool swapConst = table->consts[index];
+            table->keys[index] = key;
+            table->hashes[index] = hash;
+            table->values[index] = value;
+            table->consts[index] = isConst;
+            key = swapKey;
+            hash = swapHash;
+            value = swapValue;
+            isConst = swapConst;
+            distance = existing;
+        }
+        index = (index + 1) & mask;
+        distance++;
     }
+}
 
-    table->count = 0;
-    //이미 배열이 있는 상태에서 reallocate 동적할당을 하는 대신에(해시 키를 배열 크기로 나눈 나머지를 계산하므로)
-    //처음부터 배열을 다시 만들어서 엔트리를 다시 새로운 빈 배열에 삽입
-    for (int i = 0; i < table->capacity; i++) {
-        Entry *entry = &table->entries[i];
-        if (entry->key == NULL) continue;
+static void removeAt(Table *table, uint32_t index) {
+    //backward-shift: 뒤따르는 엔트리들 중 home에 있지 않은 것들을 한 칸씩 당겨 빈자리를 메운다
+    uint32_t mask = table->capacity - 1;
+    uint32_t next = (index + 1) & mask;
+    while (table->keys[next] != NULL && DISTANCE(table, next) > 0) {
+        table->keys[index] = table->keys[next];
+        table->hashes[index] = table->hashes[next];
+        table->values[index] = table->values[next];
+        table->consts[index] = table->consts[next];
+        index = next;
+        next = (next + 1) & mask;
+    }
+    table->keys[index] = NULL;
+    table->count--;
+}
 
-        Entry *dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        dest->isConst = entry->isConst;
-        table->count++; //툼스톤이 아닌 앤트리가 나올 때 마다 증가
+static void adjustCapacity(Table *table, int capacity) { // 버킷 배열 할당
+    //할당 도중 GC가 돌 수 있으므로 새 배열을 모두 할당한 뒤에 옛 배열을 읽는다
+    Table resized;
+    resized.capacity = capacity;
+    resized.keys = ALLOCATE(ObjString*, capacity);
+    resized.hashes = ALLOCATE(uint32_t, capacity);
+    resized.values = ALLOCATE(Value, capacity);
+    resized.consts = ALLOCATE(bool, capacity);
+    memset(resized.keys, 0, sizeof(ObjString *) * capacity);
+
+    //처음부터 배열을 다시 만들어서 엔트리를 새로운 빈 배열에 삽입
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->keys[i] == NULL) continue;
+        insertEntry(&resized, table->keys[i], table->hashes[i], table->values[i], table->consts[i]);
     }
 
-    FREE_ARRAY(Entry, table->entries, table->capacity);
-    table->entries = entries;
-    table->capacity = capacity;
+    resized.count = table->count; //할당 중 GC가 table에서 엔트리를 지웠을 수 있으므로 복사가 끝난 뒤에 읽는다
+    freeTable(table);
+    *table = resized;
 }
 
-bool tableSet(Table *table, ObjString *key, Value value, bool isConst) {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) { //Entry 배열 할당 전에 배열이 존재하는지 확인, 혹은 크기가 충분한지 확인하기
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+static void shrinkIfSparse(Table *table) {
+    //삭제로 테이블이 TABLE_MIN_LOAD보다 비면, 줄인 뒤에도 부하가 TABLE_MAX_LOAD의 절반을 넘지 않는 크기로 줄인다
+    if (table->capacity <= TABLE_MIN_CAPACITY || table->count >= table->capacity * TABLE_MIN_LOAD) return;
+    int capacity = table->capacity;
+    while (capacity > TABLE_MIN_CAPACITY && table->count + 1 <= (capacity / 2) * TABLE_MAX_LOAD / 2) {
+        capacity /= 2;
     }
-    //해당 키로 매핑된 엔트리가 존재하면 새 값으로 이전 값을 덮어씌운다
-    Entry *entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value)) table->count++; //완전히 빈 버킷에 새 엔트리가 들어갈 때만 count++(count == 앤트리 수 + 툼스톤 수)
+    adjustCapacity(table, capacity);
+}
 
-    if(!isNewKey && entry->isConst){ //const 변수는 재할당 할 수 없도록 예외 처리
+bool tableSet(Table *table, ObjString *key, Value value, bool isConst) {
+    //해당 키로 매핑된 엔트리가 존재하면 새 값으로 이전 값을 덮어씌운다
+    int index = table->count == 0 ? -1 : findEntry(table, key);
+    if (index != -1) {
+        if (table->consts[index]) return false; //const 변수는 재할당 할 수 없도록 예외 처리
+        table->values[index] = value;
+        table->consts[index] = isConst;
         return false;
     }
 
-    entry->key = key;
-    entry->value = value;
-    entry->isConst = isConst;
-
-    return isNewKey;
+    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) { //배열 할당 전에 배열이 존재하는지 확인, 혹은 크기가 충분한지 확인하기
+        adjustCapacity(table, GROW_CAPACITY(table->capacity));
+    } else {
+        shrinkIfSparse(table); //GC가 인터닝 테이블에서 문자열을 많이 지운 뒤라면 여기서 줄어든다
+    }
+    insertEntry(table, key, key->hash, value, isConst);
+    table->count++;
+    return true;
 }
 
-bool tableDelete(Table* table, ObjString* key){
-    if(table->count ==0) return false;
+bool tableDelete(Table *table, ObjString *key) {
+    if (table->count == 0) return false;
 
     //엔트리를 찾는다
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if(entry->key == NULL) return false;
+    int index = findEntry(table, key);
+    if (index == -1) return false;
 
-    //툼스톤 삽입
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+    removeAt(table, (uint32_t) index);
+    shrinkIfSparse(table);
     return true;
 }
 
-void tableAddAll(Table *from, Table *to){
-    for(int i =0; i < from->capacity; i++){
-        Entry* entry =&from->entries[i];
-        if(entry->key !=NULL ){
-            tableSet(to, entry->key, entry->value, entry->isConst);
+void tableAddAll(Table *from, Table *to) {
+    for (int i = 0; i < from->capacity; i++) {
+        if (from->keys[i] != NULL) {
+            tableSet(to, from->keys[i], from->values[i], from->consts[i]);
         }
     }
 }
 
-ObjString* tableFindString(Table* table , const char* chars, int length, uint32_t hash){
-    if(table->count == 0) return NULL;
+void markTable(Table *table) {
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->keys[i] == NULL) continue;
+        markObject((Obj *) table->keys[i]);
+        markValue(table->values[i]);
+    }
+}
 
-    uint32_t index = hash % table->capacity;
+static inline bool charsEqual(const char *a, const char *b, int length) {
+    //인터닝 후보 비교: 짧은 문자열이 대부분이라 memcmp 호출 대신 16바이트(SSE2)/8바이트 단위로 직접 비교한다
+#ifdef __SSE2__
+    while (length >= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) a);
+        __m128i y = _mm_loadu_si128((const __m128i *) b);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff) return false;
+        a += 16;
+        b += 16;
+        length -= 16;
+    }
+#endif
+    while (length >= 8) {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y) return false;
+        a += 8;
+        b += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        if (*a++ != *b++) return false;
+        length--;
+    }
+    return true;
+}
 
-    for(;;){
-        Entry* entry = &table->entries[index];
-        if(entry->key == NULL) {
-            //툼스톤이 아닌 엔트리가 나올 경우 멈춘다
-            if(IS_NIL(entry->value)) return NULL;
-        } else if(entry->key->length == length && entry->key->hash == hash &&
-                memcmp(entry->key->chars, chars, length) == 0){
-            //찾은 경우
-            return entry->key;
+//StringSet: 인터닝 전용 집합. Table과 같은 Robin Hood 배치에 key와 hash만 둔다
+
+void initStringSet(StringSet *set) {
+    set->count = 0;
+    set->capacity = 0;
+    set->keys = NULL;
+    set->hashes = NULL;
+}
+
+void freeStringSet(StringSet *set) {
+    FREE_ARRAY(ObjString*, set->keys, set->capacity);
+    FREE_ARRAY(uint32_t, set->hashes, set->capacity);
+    initStringSet(set);
+}
+
+static void setInsert(StringSet *set, ObjString *key, uint32_t hash) {
+    //key가 없다는 것이 보장된 상태에서 Robin Hood 방식으로 삽입한다 (insertEntry와 같은 방식)
+    uint32_t mask = set->capacity - 1;
+    uint32_t index = hash & mask;
+    uint32_t distance = 0;
+    for (;;) {
+        if (set->keys[index] == NULL) {
+            set->keys[index] = key;
+            set->hashes[index] = hash;
+            return;
+        }
+        uint32_t existing = DISTANCE(set, index);
+        if (existing < distance) {
+            ObjString *swapKey = set->keys[index];
+            uint32_t swapHash = set->hashes[index];
+            set->keys[index] = key;
+            set->hashes[index] = hash;
+            key = swapKey;
+            hash = swapHash;
+            distance = existing;
+        }
+        index = (index + 1) & mask;
+        distance++;
+    }
+}
+
+static void setRemoveAt(StringSet *set, uint32_t index) {
+    //backward-shift 삭제 (removeAt과 같은 방식)
+    uint32_t mask = set->capacity - 1;
+    uint32_t next = (index + 1) & mask;
+    while (set->keys[next] != NULL && DISTANCE(set, next) > 0) {
+        set->keys[index] = set->keys[next];
+        set->hashes[index] = set->hashes[next];
+        index = next;
+        next = (next + 1) & mask;
+    }
+    set->keys[index] = NULL;
+    set->count--;
+}
+
+static void setAdjustCapacity(StringSet *set, int capacity) {
+    StringSet resized;
+    resized.capacity = capacity;
+    resized.keys = ALLOCATE(ObjString*, capacity);
+    resized.hashes = ALLOCATE(uint32_t, capacity);
+    memset(resized.keys, 0, sizeof(ObjString *) * capacity);
+
+    for (int i = 0; i < set->capacity; i++) {
+        if (set->keys[i] == NULL) continue;
+        setInsert(&resized, set->keys[i], set->hashes[i]);
+    }
+
+    resized.count = set->count;
+    freeStringSet(set);
+    *set = resized;
+}
+
+void stringSetAdd(StringSet *set, ObjString *string) {
+    //호출하는 쪽(allocateString)이 먼저 stringSetFind로 없는 것을 확인한다
+    if (set->count + 1 > set->capacity * TABLE_MAX_LOAD) {
+        setAdjustCapacity(set, GROW_CAPACITY(set->capacity));
+    } else if (set->capacity > TABLE_MIN_CAPACITY && set->count < set->capacity * TABLE_MIN_LOAD) {
+        //GC가 문자열을 많이 지운 뒤: 줄인 뒤에도 부하가 TABLE_MAX_LOAD의 절반을 넘지 않는 크기로 줄인다
+        int capacity = set->capacity;
+        while (capacity > TABLE_MIN_CAPACITY && set->count + 1 <= (capacity / 2) * TABLE_MAX_LOAD / 2) {
+            capacity /= 2;
         }
+        setAdjustCapacity(set, capacity);
+    }
+    setInsert(set, string, string->hash);
+    set->count++;
+}
+
+ObjString *stringSetFind(StringSet *set, const char *chars, int length, uint32_t hash) {
+    if (set->count == 0) return NULL;
 
-        index = (index +1) % table->capacity;
+    uint32_t mask = set->capacity - 1;
+    uint32_t index = hash & mask;
+    for (uint32_t distance = 0;; distance++) {
+        ObjString *key = set->keys[index];
+        if (key == NULL || DISTANCE(set, index) < distance) return NULL;
+        //해시가 같은 후보만 key를 역참조해서 비교한다
+        if (set->hashes[index] == hash &&
+            key->length == length && charsEqual(key->chars, chars, length)) {
+            //찾은 경우
+            return key;
+        }
+        index = (index + 1) & mask;
     }
+}
 
+void stringSetRemoveWhite(StringSet *set) {
+    //인터닝 집합은 weak reference: 마킹되지 않은(곧 해제될) 문자열은 sweep 전에 집합에서 제거한다.
+    //GC 도중이므로 할당이 필요한 축소는 하지 않는다. 당겨온 엔트리를 다시 검사하기 위해 제거한 자리에서는 i를 늘리지 않는다
+    for (int i = 0; i < set->capacity;) {
+        ObjString *key = set->keys[i];
+        if (key != NULL && !key->obj.isMarked) {
+            setRemoveAt(set, (uint32_t) i);
+        } else {
+            i++;
+        }
+    }
 }
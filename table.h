@@ -4,17 +4,27 @@
 #include "common.h"
 #include "value.h"
 
+#define TABLE_MAX_LOAD 0.75
+#define TABLE_MIN_LOAD 0.125 //삭제 후 부하가 이보다 낮아지면 테이블을 줄인다
+#define TABLE_MIN_CAPACITY 8
+
 typedef struct {
-    ObjString *key; //key는 항상 문자열이기 때문에 Value로 따로 래핑은 안함
-    Value value;
-    bool isConst;
-} Entry;
+    //SoA 배치: probing은 keys/hashes만 훑고, 찾은 뒤에만 values/consts에 접근한다
+    int count; //엔트리 수 (Robin Hood + backward-shift 삭제라 툼스톤이 없다)
+    int capacity; //0 또는 2의 거듭제곱. index = hash & (capacity - 1)
+    ObjString **keys; //key는 항상 문자열이기 때문에 Value로 따로 래핑은 안함. NULL = 빈 버킷
+    uint32_t *hashes; //key->hash 사본: probe 거리를 계산할 때 key를 역참조하지 않는다
+    Value *values;
+    bool *consts;
+} Table;
 
 typedef struct {
+    //문자열 인터닝 전용 집합 (vm.strings): 버킷마다 key 포인터와 hash만 둔다. 인터닝에는 쓰이지 않는 values/consts 배열이 없다
     int count;
-    int capacity;
-    Entry *entries;
-} Table;
+    int capacity; //0 또는 2의 거듭제곱
+    ObjString **keys; //NULL = 빈 버킷
+    uint32_t *hashes; //key를 역참조하기 전에 hash로 후보를 거른다
+} StringSet;
 
 void initTable(Table *table);
 
@@ -24,15 +34,20 @@ bool tableGet(Table *table, ObjString *key, Value *value);
 
 bool tableSet(Table *table, ObjString *key, Value value, bool isConst);
 
-Entry *findEntry(Entry *entries, int capacity, ObjString *key);
-
 bool tableDelete(Table *table, ObjString *key);
 
 void tableAddAll(Table *from, Table *to);
 
-ObjString *tableFindString(Table *table, const char *chars, int length, uint32_t hash);
+void markTable(Table *table);
+
+void initStringSet(StringSet *set);
+
+void freeStringSet(StringSet *set);
+
+void stringSetAdd(StringSet *set, ObjString *string);
 
-Entry *findEntry(Entry *entries, int capacity, ObjString *key);
+ObjString *stringSetFind(StringSet *set, const char *chars, int length, uint32_t hash);
 
+void stringSetRemoveWhite(StringSet *set);
 
 #endif //CLOX_TABLE_H
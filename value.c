@@ -4,6 +4,7 @@
 #include "object.h"
 #include "memory.h"
 #include "value.h"
+#include "dtoa.h"
 
 
 void initValueArray(ValueArray *array) {
@@ -32,24 +33,54 @@ void undoPreviousWrite(ValueArray *valueArray){
     valueArray->count--;
 }
 
-void printValue(Value value) {
+static void printNumber(FILE *out, double number) {
+    char buffer[NUMBER_BUFFER_SIZE];
+    int length = formatNumber(number, buffer);
+    fwrite(buffer, 1, length, out);
+}
+
+void printValue(FILE *out, Value value) {
+#ifdef NAN_BOXING
+    if (IS_BOOL(value)) {
+        fputs(AS_BOOL(value) ? "true" : "false", out);
+    } else if (IS_NIL(value)) {
+        fputs("nil", out);
+    } else if (IS_NUMBER(value)) {
+        printNumber(out, AS_NUMBER(value));
+    } else if (IS_OBJ(value)) {
+        printObject(out, value);
+    }
+#else
     switch (value.type) {
         case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
+            fputs(AS_BOOL(value) ? "true" : "false", out);
             break;
         case VAL_NIL:
-            printf("nil");
+            fputs("nil", out);
             break;
         case VAL_NUMBER:
-            printf("%g", AS_NUMBER(value));
+            printNumber(out, AS_NUMBER(value));
             break;
         case VAL_OBJ:
-            printObject(value);
+            printObject(out, value);
+            break;
+        case VAL_UNDEFINED: //스크립트에서 보이지 않는 sentinel. NaN boxing 쪽처럼 아무것도 출력하지 않는다
             break;
     }
+#endif
 }
 
 bool valuesEqual(Value a, Value b) {
+#ifdef NAN_BOXING
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        //NaN != NaN 이므로 비트 비교가 아니라 double로 비교한다
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+#ifdef LAZY_INTERN
+    if (a != b && IS_STRING(a) && IS_STRING(b)) return stringsEqual(AS_STRING(a), AS_STRING(b));
+#endif
+    return a == b; //bool, nil은 싱글턴이고 Obj*는 문자열 인터닝 덕분에 포인터 비교로 충분하다
+#else
     if (a.type != b.type)  return false;//Value 타입이 다르면 동등하지 않다.
         switch (a.type) { //패딩과 크기가 가변적인 공용체 필드 때문에 사용하지 않는 비트도 포함될 수 있음.
             case VAL_BOOL:
@@ -59,9 +90,14 @@ bool valuesEqual(Value a, Value b) {
             case VAL_NUMBER:
                 return AS_NUMBER(a) == AS_NUMBER(b);
             case VAL_OBJ:// 서로 다른 객체든 같은 객체든 간에 모두 같은 값의 문자열일 경우 동등한 값으로 처리
+#ifdef LAZY_INTERN
+                if (AS_OBJ(a) != AS_OBJ(b) && IS_STRING(a) && IS_STRING(b)) {
+                    return stringsEqual(AS_STRING(a), AS_STRING(b));
+                }
+#endif
                 return AS_OBJ(a) == AS_OBJ(b); //문자열 인터닝으로 문자를 하나씩 비교할 필요가 없어짐
             default:
                 return false;
         }
-
+#endif
 }
\ No newline at end of file
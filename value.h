@@ -1,16 +1,68 @@
 #ifndef CLOX_VALUE_H
 #define CLOX_VALUE_H
 
+#include <stdio.h>
+
 #include "common.h"
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
+#ifdef NAN_BOXING
+//NaN boxing: double은 그대로 저장하고, bool/nil/Obj*는 quiet NaN의 남는 비트(payload)에 인코딩한다.
+//Value가 8 bytes가 되므로 VM 스택, 상수 배열, 테이블 엔트리의 메모리 사용량이 절반이 된다.
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN     ((uint64_t)0x7ffc000000000000) //exponent 비트 전부 + quiet 비트 + Intel FP Indefinite 회피용 비트
+
+#define TAG_NIL   1 // 01.
+#define TAG_FALSE 2 // 10.
+#define TAG_TRUE  3 // 11.
+#define TAG_UNDEFINED 4 // 100.
+
+typedef uint64_t Value;
+
+//type check for Value
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value) ((value) == NIL_VAL)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN) //quiet NaN 비트가 모두 켜져 있지 않다면 숫자
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT)) //부호 비트가 켜진 quiet NaN은 Obj*
+
+//get value in c type
+#define AS_OBJ(value) ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) valueToNum(value)
+
+//promote macro -----> wrapping Value
+#define BOOL_VAL(b)       ((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL         ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL          ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VAL           ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define UNDEFINED_VAL     ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define NUMBER_VAL(num)   numToValue(num)
+#define OBJ_VAL(obj)      (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+static inline double valueToNum(Value value) {
+    double num; //type punning은 memcpy로, 컴파일러가 레지스터 이동으로 최적화한다
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+static inline Value numToValue(double num) {
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+#else
+
 typedef enum {
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
     VAL_OBJ, //payload는 heap memory를 가르키는 포인터
+    VAL_UNDEFINED,
 } ValueType;
 
 typedef struct { //sizeof(type) +padding 4 bytes + sizeof(double) = 16 bytes
@@ -25,6 +77,7 @@ typedef struct { //sizeof(type) +padding 4 bytes + sizeof(double) = 16 bytes
 //type check for Value
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NIL(value) ((value).type == VAL_NIL)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
@@ -36,9 +89,14 @@ typedef struct { //sizeof(type) +padding 4 bytes + sizeof(double) = 16 bytes
 //promote macro -----> wrapping Value
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL         ((Value){VAL_NIL, {.number=0}})
+#define UNDEFINED_VAL   ((Value){VAL_UNDEFINED, {.number=0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number= value}})
 #define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
+#endif
+
+//UNDEFINED_VAL은 아직 정의되지 않은 전역 변수 슬롯을 나타내는 VM 내부 sentinel이다. 스크립트에서는 절대 보이지 않는다.
+
 typedef struct {
     int capacity;
     int count;
@@ -55,6 +113,6 @@ void freeValueArray(ValueArray *array);
 
 void undoPreviousWrite(ValueArray *valueArray);
 
-void printValue(Value value);
+void printValue(FILE *out, Value value);
 
 #endif //CLOX_VALUE_H
@@ -12,39 +12,106 @@
 #include "compiler.h"
 #include "object.h"
 #include "memory.h"
+#include "dtoa.h"
+#include "snapshot.h"
+#include "bytecode.h"
 
-VM vm;
+_Thread_local VM vm;
 
-static Value clockNative(int argCount, Value *args) {
-    return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+static NativeResult clockNative(int argCount, Value *args) {
+    args[-1] = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    return NATIVE_RETURN;
+}
+
+static void closeUpValues(Value *last);
+
+static FiberStack *savedStack(ObjFiber *fiber) {
+    return fiber == NULL ? &vm.root : &fiber->saved;
+}
+
+static void switchFiber(ObjFiber *fiber) {
+    //실행 중인 상태를 저장하고 fiber의 상태를 불러온다. 스택과 프레임 배열은 복사하지 않고 포인터만 바꾼다
+    FiberStack *from = savedStack(vm.fiber);
+    from->frames = vm.frames;
+    from->frameCount = vm.frameCount;
+    from->frameCapacity = vm.frameCapacity;
+    from->stack = vm.stack;
+    from->stackTop = vm.stackTop;
+    from->stackCapacity = vm.stackCapacity;
+    from->openUpValues = vm.openUpValues;
+
+    FiberStack *to = savedStack(fiber);
+    vm.fiber = fiber;
+    vm.frames = to->frames;
+    vm.frameCount = to->frameCount;
+    vm.frameCapacity = to->frameCapacity;
+    vm.stack = to->stack;
+    vm.stackTop = to->stackTop;
+    vm.stackCapacity = to->stackCapacity;
+    vm.openUpValues = to->openUpValues;
+}
+
+static void endFiber() {
+    //실행 중인 fiber를 끝내고 resume한 쪽으로 돌아간다. 다시 실행될 일이 없으므로 스택은 바로 해제한다
+    ObjFiber *fiber = vm.fiber;
+    closeUpValues(vm.stack); //에러로 끝날 때는 아직 열린 upvalue가 남아 있다
+    vm.stackTop = vm.stack;
+    vm.frameCount = 0;
+    fiber->state = FIBER_DONE;
+    ObjFiber *caller = fiber->caller;
+    fiber->caller = NULL;
+    switchFiber(caller);
+
+    FREE_ARRAY(Value, fiber->saved.stack, fiber->saved.stackCapacity);
+    FREE_ARRAY(CallFrame, fiber->saved.frames, fiber->saved.frameCapacity);
+    memset(&fiber->saved, 0, sizeof(FiberStack));
+}
+
+static void finishFiber(Value result) {
+    //fiber의 함수가 반환했다: 반환값이 resume(...)의 결과가 된다
+    endFiber();
+    vm.stackTop[-1] = result;
 }
 
 static void resetStack() {
+    //에러로 중단되면 실행 중이던 fiber들을 모두 끝내고 메인 스크립트의 스택으로 돌아간다
+    while (vm.fiber != NULL) {
+        endFiber();
+    }
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
     vm.openUpValues = NULL;
 }
 
+static void printStackTrace(CallFrame *frames, int frameCount) {
+    for (int i = frameCount - 1; i >= 0; i--) {
+        CallFrame *frame = &frames[i];
+        ObjFunction *function = frame->closure->function; // -1 because the IP is sitting on the next instruction to be
+        size_t instruction = frame->ip - function->chunk.code - 1;
+        fprintf(vm.err, "[line %d] in ", function->chunk.lines[instruction]);
+        if (function->name == NULL) {
+            fprintf(vm.err, "script\n");
+        } else {
+            fprintf(vm.err, " %s", function->name->chars);
+        }
+    }
+}
+
 static void runtimeError(const char *format, ...) {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm.err, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm.err);
 
     // CallFrame *frame = &vm.frames[vm.frameCount - 1]; //vm에서 직접 chunk.ip를 읽는 대신 스택 최상위의 callFrame에서 가져오기
     // size_t instruction = frame->ip - frame->function->chunk.code - 1; //runtimeError()를 호출한 시점의 실패한 명령어는 이전의 명령어다
     // int line = frame->function->chunk.lines[instruction];
-    for (int i = vm.frameCount - 1; i >= 0; i--) {
-        CallFrame *frame = &vm.frames[i];
-        ObjFunction *function = frame->closure->function; // -1 because the IP is sitting on the next instruction to be
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
-        if (function->name == NULL) {
-            fprintf(stderr, "script\n");
-        } else {
-            fprintf(stderr, " %s", function->name->chars);
-        }
+    printStackTrace(vm.frames, vm.frameCount);
+    for (ObjFiber *fiber = vm.fiber; fiber != NULL; fiber = fiber->caller) {
+        //fiber 안에서 난 에러는 그 fiber를 resume한 쪽들의 호출 경로까지 출력한다
+        FiberStack *caller = savedStack(fiber->caller);
+        printStackTrace(caller->frames, caller->frameCount);
     }
 
     // fprintf(stderr, "[line %d] in script\n", line);
@@ -52,25 +119,97 @@ static void runtimeError(const char *format, ...) {
 }
 
 static void defineNative(const char *name, NativeFn function) {
+    //native 함수도 일반 전역 변수처럼 슬롯을 할당받는다
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
     push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1], false);
+    int slot = globalSlot(AS_STRING(vm.stack[0]));
+    vm.globals.values.values[slot] = vm.stack[1];
+    pop();
     pop();
+}
+
+int globalSlot(ObjString *name) {
+    //컴파일러가 전역 변수 이름을 슬롯 인덱스로 해석할 때 사용한다. 처음 보는 이름이면 UNDEFINED_VAL 슬롯을 새로 만든다
+    Value index;
+    if (tableGet(&vm.globals.slots, name, &index)) {
+        return (int) AS_NUMBER(index);
+    }
+
+    int slot = vm.globals.values.count;
+    GlobalVar var = {.name = name, .isConst = false};
+    push(OBJ_VAL(name)); //배열이 커지면서 GC가 돌 수 있으므로 name을 스택에 올려둔다
+    writeValueArray(&vm.globals.values, UNDEFINED_VAL);
+    writeArray(&vm.globals.vars, &var);
+    tableSet(&vm.globals.slots, name, NUMBER_VAL((double) slot), false);
     pop();
+    return slot;
+}
+
+static void initGlobals(Globals *globals) {
+    initTable(&globals->slots);
+    initValueArray(&globals->values);
+    initArray(&globals->vars, sizeof(GlobalVar));
+}
+
+static void freeGlobals(Globals *globals) {
+    freeTable(&globals->slots);
+    freeValueArray(&globals->values);
+    freeArray(&globals->vars);
+}
+
+static uint64_t makeHashSeed() {
+#ifdef RANDOM_HASH_SEED
+    //해시 충돌을 노린 입력(같은 버킷으로 몰리는 key)을 막기 위해 실행마다 다른 seed를 쓴다
+    uint64_t seed = 0;
+    FILE *random = fopen("/dev/urandom", "rb");
+    if (random == NULL || fread(&seed, sizeof(seed), 1, random) != 1) {
+        seed = (uint64_t) time(NULL) ^ (uint64_t) (uintptr_t) &seed;
+    }
+    if (random != NULL) fclose(random);
+    return seed;
+#else
+    return 0; //고정 seed: 실행마다 테이블 배치가 같아서 벤치마크 결과를 재현할 수 있다
+#endif
 }
 
 void initVM() {
+    vm.fiber = NULL;
+    vm.frames = vm.rootFrames;
+    vm.frameCapacity = FRAMES_MAX;
+    vm.stack = vm.rootStack;
+    vm.stackCapacity = STACK_MAX;
     resetStack();
+    vm.hashSeed = makeHashSeed(); //문자열을 처음 만들기 전에 정해져야 한다
     vm.objects = NULL;
-    initTable(&vm.globals); //hash table
-    initTable(&vm.strings); //string interning
-    defineNative("clock", clockNative);
+    vm.bytesAllocated = 0;
+    vm.nextGC = 1024 * 1024;
+    vm.grayCount = 0;
+    vm.grayCapacity = 0;
+    vm.grayStack = NULL;
+    vm.out = stdout;
+    vm.err = stderr;
+    vm.traceExecution = false;
+    vm.printCode = false;
+    vm.countInstructions = false;
+    vm.lazyCompile = false;
+    vm.instructionCount = 0;
+    for (int i = 0; i < SMALL_INT_STRINGS; i++) {
+        vm.smallIntStrings[i] = NULL;
+    }
+
+    initGlobals(&vm.globals); //전역 변수 슬롯
+    initStringSet(&vm.strings); //string interning
+    for (int i = 0; i < nativeCount; i++) {
+        defineNative(natives[i].name, natives[i].function);
+    }
 }
 
 void freeVM() {
-    freeTable(&vm.globals);
-    freeTable(&vm.strings);
+    freeGlobals(&vm.globals);
+    freeStringSet(&vm.strings);
     freeObjects();
+    closeSnapshot(); //heap 객체가 모두 해제된 뒤에 이미지를 unmap한다
+    closeBytecode(); //.loxc에서 불러온 함수의 code도 같은 이유로 여기서 unmap한다
 }
 
 void push(Value value) {
@@ -87,7 +226,34 @@ static Value peek(int distance) {
     return vm.stackTop[-1 - distance]; //후에 gc가 트리거되면 피연산자를 스택에 남겨서 관리하기 위함
 }
 
+static void growStack(int needed) {
+    //fiber의 값 스택을 새 배열로 옮긴다. 스택 안을 가리키는 포인터(frame의 slots, 열린 upvalue, stackTop)도 함께 옮긴다.
+    //run loop는 호출 뒤에 LOAD_FRAME으로 다시 읽으므로 캐시된 sp와 slots는 따로 고칠 필요가 없다
+    int capacity = vm.stackCapacity;
+    while (capacity < needed) capacity *= 2;
+    if (capacity > STACK_MAX) capacity = STACK_MAX;
+
+    Value *stack = ALLOCATE(Value, capacity); //GC가 돌아도 아직 이전 스택이 root다
+    Value *old = vm.stack;
+    memcpy(stack, old, sizeof(Value) * (vm.stackTop - old));
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].slots = stack + (vm.frames[i].slots - old);
+    }
+    for (ObjUpValue *upValue = vm.openUpValues; upValue != NULL; upValue = upValue->pNext) {
+        upValue->location = stack + (upValue->location - old);
+    }
+    vm.stackTop = stack + (vm.stackTop - old);
+    vm.stack = stack;
+    FREE_ARRAY(Value, old, vm.stackCapacity);
+    vm.stackCapacity = capacity;
+}
+
 static bool call(ObjClosure *closure, int argCount) {
+    //--lazy: 처음 호출되는 함수는 여기서 본문을 컴파일한다 (arity와 maxSlots도 이때 정해진다)
+    if (closure->function->lazy != NULL && !compileLazyFunction(closure->function)) {
+        runtimeError("Could not compile function '%s'.", closure->function->name->chars);
+        return false;
+    }
     if (argCount != closure->function->arity) {
         runtimeError("Expected %d arguments, but got %d", closure->function->arity, argCount);
         return false;
@@ -97,6 +263,21 @@ static bool call(ObjClosure *closure, int argCount) {
         runtimeError("Stack overflow");
         return false;
     }
+    //지역 변수가 256개를 넘을 수 있으므로 (OP_WIDE) 프레임 수만으로는 값 스택이 넘치지 않는다고 보장할 수 없다.
+    //중간값을 위한 여유로 UINT8_COUNT 슬롯을 더 남겨둔다
+    int needed = (int) (vm.stackTop - vm.stack) - argCount - 1 + closure->function->maxSlots + UINT8_COUNT;
+    if (needed > STACK_MAX) {
+        runtimeError("Stack overflow");
+        return false;
+    }
+    //메인 스크립트의 스택은 처음부터 최대 크기이므로 아래 두 경우는 fiber에서만 생긴다
+    if (needed > vm.stackCapacity) growStack(needed);
+    if (vm.frameCount == vm.frameCapacity) {
+        int capacity = GROW_CAPACITY(vm.frameCapacity);
+        if (capacity > FRAMES_MAX) capacity = FRAMES_MAX;
+        vm.frames = GROW_ARRAY(CallFrame, vm.frames, vm.frameCapacity, capacity);
+        vm.frameCapacity = capacity;
+    }
 
     CallFrame *frame = &vm.frames[vm.frameCount++];
     frame->closure = closure;
@@ -117,11 +298,10 @@ static bool callValue(Value callee, int argCount) {
             // case OBJ_FUNCTION:
             //        return call(AS_FUNCTION(callee), argCount);
             case OBJ_NATIVE: {
-                NativeFn native = AS_NATIVE(callee);
-                Value result = native(argCount, vm.stackTop - argCount);
-                vm.stackTop -= argCount + 1;
-                push(result);
-                return true;
+                Value *args = vm.stackTop - argCount;
+                NativeResult result = AS_NATIVE(callee)(argCount, args);
+                if (result == NATIVE_RETURN) vm.stackTop = args; //반환값은 args[-1]에 남는다
+                return result != NATIVE_ERROR;
             }
             default:
                 break;
@@ -142,6 +322,9 @@ static ObjUpValue *captureUpValue(Value *local) {
         return upvalue;
     }
     ObjUpValue *createdUpValue = newUpValue(local);
+    //열려 있는 동안에는 closed를 쓰지 않으므로 스택의 주인인 fiber를 넣어둔다.
+    //upvalue를 붙잡은 클로저가 살아 있는 한 GC가 fiber(와 location이 가리키는 스택)를 회수하지 않는다
+    if (vm.fiber != NULL) createdUpValue->closed = OBJ_VAL(vm.fiber);
     createdUpValue->pNext = upvalue;
     if (prevUpvalue == NULL) {
         vm.openUpValues = createdUpValue;
@@ -161,304 +344,214 @@ static void closeUpValues(Value *last) {
     }
 }
 
+static NativeResult fiberNative(int argCount, Value *args) {
+    if (argCount != 1 || !IS_CLOSURE(args[0])) {
+        runtimeError("fiber() takes a function.");
+        return NATIVE_ERROR;
+    }
+    args[-1] = OBJ_VAL(newFiber(AS_CLOSURE(args[0])));
+    return NATIVE_RETURN;
+}
+
+static NativeResult resumeNative(int argCount, Value *args) {
+    //resume(fiber, value?): fiber를 이어서 실행한다. 처음이면 value가 함수의 인자가 되고, 아니면 멈춰 있던 yield(...)의 결과가 된다.
+    //fiber가 yield하거나 반환하면 그 값이 이 호출의 결과다
+    if (argCount < 1 || argCount > 2 || !IS_FIBER(args[0])) {
+        runtimeError("resume() takes a fiber and an optional value.");
+        return NATIVE_ERROR;
+    }
+    ObjFiber *fiber = AS_FIBER(args[0]);
+    if (fiber->state == FIBER_RUNNING) {
+        runtimeError("Cannot resume a running fiber.");
+        return NATIVE_ERROR;
+    }
+    if (fiber->state == FIBER_DONE) {
+        runtimeError("Cannot resume a finished fiber.");
+        return NATIVE_ERROR;
+    }
+
+    Value value = argCount == 2 ? args[1] : NIL_VAL;
+    bool started = fiber->state == FIBER_SUSPENDED;
+    vm.stackTop = args; //돌아왔을 때 결과는 args[-1]에 들어간다
+    fiber->caller = vm.fiber;
+    fiber->state = FIBER_RUNNING;
+    switchFiber(fiber);
+    if (started) {
+        vm.stackTop[-1] = value;
+        return NATIVE_SWITCH;
+    }
+    if (argCount == 2) push(value);
+    return call(AS_CLOSURE(vm.stack[0]), argCount - 1) ? NATIVE_SWITCH : NATIVE_ERROR;
+}
+
+static NativeResult yieldNative(int argCount, Value *args) {
+    //yield(value?): 실행 중인 fiber를 멈추고 resume한 쪽으로 value를 돌려준다
+    if (argCount > 1) {
+        runtimeError("yield() takes an optional value.");
+        return NATIVE_ERROR;
+    }
+    if (vm.fiber == NULL) {
+        runtimeError("Cannot yield from the main script.");
+        return NATIVE_ERROR;
+    }
+
+    Value value = argCount == 1 ? args[0] : NIL_VAL;
+    ObjFiber *fiber = vm.fiber;
+    vm.stackTop = args; //다음 resume의 값이 args[-1]에 들어간다
+    fiber->state = FIBER_SUSPENDED;
+    ObjFiber *caller = fiber->caller;
+    fiber->caller = NULL;
+    switchFiber(caller);
+    vm.stackTop[-1] = value;
+    return NATIVE_SWITCH;
+}
+
+static NativeResult isDoneNative(int argCount, Value *args) {
+    if (argCount != 1 || !IS_FIBER(args[0])) {
+        runtimeError("isDone() takes a fiber.");
+        return NATIVE_ERROR;
+    }
+    args[-1] = BOOL_VAL(AS_FIBER(args[0])->state == FIBER_DONE);
+    return NATIVE_RETURN;
+}
+
+//스냅샷은 native 함수의 주소 대신 이 배열의 인덱스를 저장한다 (주소는 실행 파일과 ASLR에 따라 달라진다)
+const NativeDef natives[] = {
+    {"clock", clockNative},
+    {"fiber", fiberNative},
+    {"resume", resumeNative},
+    {"yield", yieldNative},
+    {"isDone", isDoneNative},
+};
+const int nativeCount = (int) (sizeof(natives) / sizeof(natives[0]));
+
+static Obj *ropePiece(Value value) {
+    //이미 flatten된 rope는 캐시된 문자열을 조각으로 쓴다 (rope 노드 체인을 더 붙잡고 있지 않도록)
+    if (IS_ROPE(value) && AS_ROPE(value)->flat != NULL) return (Obj *) AS_ROPE(value)->flat;
+    return AS_OBJ(value);
+}
+
 static void concatenate() {
-    ObjString *b = AS_STRING(pop());
-    ObjString *a = AS_STRING(pop());
-
-    int length = a->length + b->length;
-    char *chars = ALLOCATE(char, length + 1); // + '\0'
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
-    //나중에 복사한 문자열 사본을 메모리에서 해제해야 함
-    ObjString *result = takeString(chars, length);
-    push(OBJ_VAL(result));
+    //새 문자열을 할당하는 동안 GC가 피연산자를 회수하지 않도록 스택에 남겨둔다
+    Value b = peek(0);
+    Value a = peek(1);
+    int aLength = IS_ROPE(a) ? AS_ROPE(a)->length : AS_STRING(a)->length;
+    int bLength = IS_ROPE(b) ? AS_ROPE(b)->length : AS_STRING(b)->length;
+
+    Value result;
+    if (aLength + bLength >= ROPE_MIN_LENGTH) {
+        //긴 결과는 복사하지 않고 rope로 만든다 (rope는 항상 ROPE_MIN_LENGTH 이상이므로 짧은 쪽은 둘 다 평평한 문자열이다)
+        result = OBJ_VAL(newRope(ropePiece(a), ropePiece(b), aLength + bLength));
+    } else {
+        //결과 객체에 바로 이어 붙인다 (중간 버퍼 없이 할당 한 번)
+        ObjString *string = allocateString(aLength + bLength);
+        memcpy(string->chars, AS_STRING(a)->chars, aLength);
+        memcpy(string->chars + aLength, AS_STRING(b)->chars, bLength);
+        result = OBJ_VAL(finishString(string));
+    }
+    pop();
+    pop();
+    push(result);
 }
 
-static void toString(Value value) {
-    switch (value.type) {
-        case VAL_BOOL:
-            push(OBJ_VAL(copyString(value.as.boolean ? "true" : "false", value.as.boolean ? 4 : 5)));
-            break;
-        case VAL_NUMBER: {
-            char buffer[24];
-            int length = sprintf(buffer, "%g", value.as.number);
-            push(OBJ_VAL(copyString(buffer, length)));
-            break;
-        }
-        case VAL_OBJ:
-            // 객체의 toString 메소드 호출 추후에 추가할 예정
-            push(OBJ_VAL(objToString(value.as.obj)));
-            break;
-        default:
-            push(OBJ_VAL(copyString("nil", 3)));
-            break;
-    }
-}
-
-static InterpretResult run() {
-    CallFrame *frame = &vm.frames[vm.frameCount - 1];
-#define READ_BYTE() (*frame->ip++) //bytecode dispatch
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
-    //#define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
-#define READ_SHORT() \
-    (frame->ip +=2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_CONSTANT_LONG() (frame->closure->function->chunk.constants.values[(READ_BYTE() << 16) | (READ_BYTE() << 8) | READ_BYTE()])
-#define READ_STRING() AS_STRING(READ_CONSTANT())
-#define BINARY_OP(valueType, op) \
-    do{\
-        if(!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtimeError("Operands must be numbers.");   \
-            return INTERPRET_RUNTIME_ERROR;\
-        }             \
-        double b = AS_NUMBER(pop());                     \
-        double a = AS_NUMBER(pop());                     \
-        push(valueType(a op b));\
-        }while (false)
-
-    for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION //플래그가 켜지면 vm이 실행하기 직전에 디스어셈블한 결과를 매번 동적으로 출력
-        printf("          ");
-        for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
-            printf("[ ");
-            printValue(*slot);
-            printf(" ]");
+static bool isSmallInt(double number) {
+    return number >= 0 && number < SMALL_INT_STRINGS && number == (int) number && !signbit(number);
+}
+
+static ObjString *smallIntString(int number) {
+    //"${i}"처럼 자주 보간되는 작은 정수는 한 번 만든 문자열을 재사용해서 포맷/해싱/인터닝 조회를 건너뛴다
+    ObjString *string = vm.smallIntStrings[number];
+    if (string == NULL) {
+        char buffer[NUMBER_BUFFER_SIZE];
+        string = copyString(buffer, formatNumber(number, buffer));
+        vm.smallIntStrings[number] = string;
+    }
+    return string;
+}
+
+static const char *pieceText(Value value, char *numberBuffer, int *length) {
+    //보간 조각 하나의 문자열 표현. rope는 연속된 문자가 없으므로 NULL을 반환하고 길이만 알려준다
+    if (IS_STRING(value)) {
+        *length = AS_STRING(value)->length;
+        return AS_CSTRING(value);
+    } else if (IS_ROPE(value)) {
+        *length = AS_ROPE(value)->length;
+        return NULL;
+    } else if (IS_NUMBER(value)) {
+        *length = formatNumber(AS_NUMBER(value), numberBuffer);
+        return numberBuffer;
+    } else if (IS_BOOL(value)) {
+        *length = AS_BOOL(value) ? 4 : 5;
+        return AS_BOOL(value) ? "true" : "false";
+    }
+    *length = 3;
+    return "nil";
+}
+
+static void joinPieces(int count) {
+    //스택 위의 count개 값을 문자열로 바꿔 정확한 크기의 결과 객체 하나에 바로 이어 붙이고, 최종 결과만 해싱/인터닝한다.
+    //조각들은 끝날 때까지 스택에 남겨 GC root로 둔다 (GC는 객체를 옮기지 않으므로 chars 포인터도 그대로 유효하다)
+    Value *pieces = vm.stackTop - count;
+    if (count == 1 && IS_TEXT(pieces[0])) return; //"${s}"
+    if (count == 1 && IS_NUMBER(pieces[0]) && isSmallInt(AS_NUMBER(pieces[0]))) {
+        pieces[0] = OBJ_VAL(smallIntString((int) AS_NUMBER(pieces[0])));
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (IS_OBJ(pieces[i]) && !IS_TEXT(pieces[i])) {
+            // 객체의 toString 메소드 호출 추후에 추가할 예정. 결과 문자열을 스택 자리에 바꿔 넣어 GC로부터 보호한다
+            pieces[i] = OBJ_VAL(objToString(AS_OBJ(pieces[i])));
         }
-        printf("\n");
-        // disassembleInstruction(vm.chunk, (int) (vm.ip - vm.chunk->code));
-        disassembleInstruction(&frame->closure->function->chunk,
-                               (int) (frame->ip - frame->closure->function->chunk.code));
-#endif
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
-            case OP_CONSTANT: {
-                Value constant = READ_CONSTANT();
-                push(constant);
-                break;
-            }
-            case OP_CONSTANT_LONG: {
-                Value constant = READ_CONSTANT_LONG();
-                push(constant);
-                break;
-            }
-            case OP_NIL:
-                push(NIL_VAL);
-                break;
-            case OP_TRUE:
-                push(BOOL_VAL(true));
-                break;
-            case OP_FALSE:
-                push(BOOL_VAL(false));
-                break;
-            case OP_POP:
-                pop();
-                break;
-            case OP_GET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                // push(vm.stack[slot]);
-                push(frame->slots[slot]);
-                break;
-            }
-            case OP_SET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                // vm.stack[slot] = peek(0); //할당은 표현식이고 모든 표현식은 값을 만들어낸다. 할당식의 값은 할당된 값 그 자체이므로 pop()은 하지 않는다
-                frame->slots[slot] = peek(0);
-                break;
-            }
-            case OP_GET_GLOBAL: {
-                ObjString *name = READ_STRING(); // 추가된 디버깅 출력
-                Value value;
-                if (!tableGet(&vm.globals, name, &value)) {
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(value);
-                break;
-            }
-            case OP_DEFINE_CONST_GLOBAL: {
-                //테이블에 키가 이미 있는지 확인은 하지 않는다.
-                //키가 이미 해시 테이블에 있는 경우 그냥 값을 덮어씌운다
-                ObjString *name = READ_STRING();
-                if (!tableSet(&vm.globals, name, peek(0), true)) {
-                    runtimeError("Variable '%s' already defined.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                pop();
-                break;
-            }
-            case OP_DEFINE_LET_GLOBAL: {
-                ObjString *name = READ_STRING();
-                if (!tableSet(&vm.globals, name, peek(0), false)) {
-                    runtimeError("Variable '%s' already defined.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                pop();
-                break;
-            }
-            case OP_SET_GLOBAL: {
-                //변수를 set 해도 스택에서 값을 pop()하지 않는다. 할당은 표현식이다
-                ObjString *name = READ_STRING();
-                bool isConst = findEntry(vm.globals.entries, vm.globals.capacity, name)->isConst;
-                if (isConst) {
-                    runtimeError("Can't assign to constant variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if (tableSet(&vm.globals, name, peek(0), isConst)) {
-                    tableDelete(&vm.globals, name);
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_GET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                push(*frame->closure->upValues[slot]->location);
-                break;
-            }
-            case OP_SET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                *frame->closure->upValues[slot]->location = peek(0);
-                break;
-            }
-            case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
-                break;
-            }
-            case OP_EQUAL_PRESERVE: {
-                Value b = pop();
-                Value a = peek(0);
-                push(BOOL_VAL(valuesEqual(a, b)));
-                break;
-            }
-            case OP_GREATER:
-                BINARY_OP(BOOL_VAL, >);
-                break;
-            case OP_LESS:
-                BINARY_OP(BOOL_VAL, <);
-                break;
-            case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
-                } else {
-                    runtimeError("Operands must be two numbers or two strings.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_SUBTRACT:
-                BINARY_OP(NUMBER_VAL, -);
-                break;
-            case OP_MULTIPLY:
-                BINARY_OP(NUMBER_VAL, *);
-                break;
-            case OP_DIVIDE:
-                BINARY_OP(NUMBER_VAL, /);
-                break;
-            case OP_MODULO: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
-                    runtimeError("Operand must be a number");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(fmod(a, b)));
-                break;
-            }
-            case OP_NOT:
-                push(BOOL_VAL(isFalsey(pop())));
-                break;
-            case OP_NEGATIVE:
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
-                break;
-            case OP_PRINT:
-                printValue(pop());
-                break;
-            case OP_PRINTLN:
-                printValue(pop());
-                printf("\n");
-                break;
-            case OP_TOSTRING: {
-                Value value = pop();
-                toString(value);
-                break;
-            }
-            case OP_JUMP: {
-                uint16_t offset = READ_SHORT();
-                // vm.ip += offset;
-                frame->ip += offset;
-                break;
-            }
-            case OP_JUMP_IF_FALSE: {
-                uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(0))) frame->ip += offset;
-                break;
-            }
-            case OP_LOOP: {
-                uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
-                break;
-            }
-            case OP_CALL: {
-                int argCount = READ_BYTE();
-                if (!callValue(peek(argCount), argCount)) {
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
-            }
-            case OP_CLOSURE: {
-                ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
-                ObjClosure *closure = newClosure(function);
-                push(OBJ_VAL(closure));
-                for (int i = 0; i < closure->upValueCount; i++) {
-                    uint8_t isLocal = READ_BYTE();
-                    uint16_t index = READ_BYTE();
-                    if (isLocal) {
-                        closure->upValues[i] = captureUpValue(frame->slots + index);
-                    } else {
-                        closure->upValues[i] = frame->closure->upValues[index];
-                    }
-                }
+    }
 
-                break;
-            }
-            case OP_CLOSE_UPVALUE:
-                closeUpValues(vm.stackTop - 1);
-                pop();
-                break;
-            case OP_RETURN: {
-                Value result = pop();
-                closeUpValues(frame->slots);
-                vm.frameCount--;
-                if (vm.frameCount == 0) {
-                    pop();
-                    return INTERPRET_OK;
-                }
-                vm.stackTop = frame->slots;
-                push(result);
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
-            }
+    char numbers[UINT8_MAX][NUMBER_BUFFER_SIZE]; //숫자는 한 번만 포맷해서 복사할 때 재사용한다
+    const char *texts[UINT8_MAX];
+    int lengths[UINT8_MAX];
+    int length = 0;
+    for (int i = 0; i < count; i++) {
+        texts[i] = pieceText(pieces[i], numbers[i], &lengths[i]);
+        length += lengths[i];
+    }
+
+    ObjString *result = allocateString(length);
+    char *dest = result->chars;
+    for (int i = 0; i < count; i++) {
+        if (texts[i] != NULL) {
+            memcpy(dest, texts[i], lengths[i]);
+        } else {
+            copyRope(AS_ROPE(pieces[i]), dest);
         }
+        dest += lengths[i];
+    }
+    result = finishString(result);
+    vm.stackTop = pieces;
+    push(OBJ_VAL(result));
+}
+
+static void buildString(int count) {
+    Value *pieces = vm.stackTop - count;
+    if (count > 1 && IS_ROPE(pieces[0])) {
+        //"${log}..." 처럼 누적 중인 rope가 맨 앞에 오면 복사하지 않고 나머지만 만든 뒤 rope로 이어 붙인다.
+        //나머지 조각의 rope는 그대로 복사하므로 재귀하지 않는다 (조각 버퍼가 C 스택에 한 벌만 놓인다)
+        joinPieces(count - 1);
+        concatenate();
+        return;
     }
-#undef READ_BYTE
-#undef READ_CONSTANT
-#undef READ_SHORT
-#undef READ_CONSTANT_LONG
-#undef READ_STRING
-#undef BINARY_OP
+    joinPieces(count);
 }
 
+#define RUN_FUNCTION run
+#include "dispatch.h"
+
+#define RUN_FUNCTION runTraced
+#define TRACE_EXECUTION
+#include "dispatch.h"
+
+#define RUN_FUNCTION runCounted
+#define COUNT_INSTRUCTIONS
+#include "dispatch.h"
+
 InterpretResult interpret(const char *source) {
     // Chunk chunk;
     // initChunk(&chunk);
@@ -469,12 +562,19 @@ InterpretResult interpret(const char *source) {
     // vm.chunk = &chunk;
     // vm.ip = vm.chunk->code;
     ObjFunction *function = compile(source);
-    if (function == NULL) return INTERPRET_RUNTIME_ERROR;
+    if (function == NULL) return INTERPRET_COMPILE_ERROR;
+    return interpretFunction(function);
+}
+
+InterpretResult interpretFunction(ObjFunction *function) {
+    //컴파일된 (또는 .loxc에서 불러온) 최상위 스크립트를 실행한다
     push(OBJ_VAL(function));
     ObjClosure *closure = newClosure(function);
     pop();
     push(OBJ_VAL(closure));
-    callValue(OBJ_VAL(closure), 0);
+    if (!callValue(OBJ_VAL(closure), 0)) return INTERPRET_RUNTIME_ERROR;
 
+    if (vm.traceExecution) return runTraced();
+    if (vm.countInstructions) return runCounted();
     return run();
 }
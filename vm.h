@@ -1,32 +1,73 @@
 #ifndef CLOX_VM_H
 #define CLOX_VM_H
 
+#include <stdio.h>
+
 #include "chunk.h"
 #include "object.h"
 #include "value.h"
 #include "table.h"
+#include "memory.h"
 
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+#define SMALL_INT_STRINGS 1024 //"0" ~ "1023"
 
-typedef struct { // framePointer, basePointer
+typedef struct CallFrame { // framePointer, basePointer
     ObjClosure* closure;
     uint8_t* ip;
     Value* slots; //함수가 사용할 수 있는 첫번째 슬롯에 위치한 vm의 스택을 가르킨다.
 }CallFrame;
 
 typedef struct {
-    CallFrame frames[FRAMES_MAX];
+    ObjString *name; //런타임 에러 메시지 출력용
+    bool isConst;
+} GlobalVar;
+
+typedef struct {
+    //전역 변수는 컴파일 타임에 슬롯 인덱스로 해석되므로 런타임에는 해싱 없이 배열 인덱싱만 한다
+    Table slots; //이름 -> values 배열의 인덱스(NUMBER_VAL)
+    ValueArray values; //정의되기 전의 슬롯은 UNDEFINED_VAL
+    Array vars; //슬롯별 GlobalVar
+} Globals;
+
+typedef struct {
+    //실행 중인 fiber의 상태. 전환할 때는 배열을 복사하지 않고 이 포인터들만 바꿔 끼운다
+    CallFrame *frames; //메인 스크립트면 rootFrames
     int frameCount;
+    int frameCapacity;
     Chunk *chunk;
     uint8_t *ip; //(instruction pointer): 항상 현재 처리중인 명령어가 아니라 다음에 실행할 명령어를 가르킨다
-    Value stack[STACK_MAX];
+    Value *stack; //메인 스크립트면 rootStack
     Value *stackTop;
-    Table globals;
-    Table strings;
+    int stackCapacity;
     ObjUpValue* openUpValues;
+    ObjFiber *fiber; //실행 중인 fiber. NULL이면 메인 스크립트
+    FiberStack root; //fiber가 실행되는 동안 저장해둔 메인 스크립트의 상태
+    Globals globals;
+    StringSet strings; //인터닝된 문자열 (weak)
+    uint64_t hashSeed; //hashString의 시작값. RANDOM_HASH_SEED 빌드에서는 실행마다 바뀐다
+    ObjString *smallIntStrings[SMALL_INT_STRINGS]; //작은 정수의 문자열 캐시 (처음 쓸 때 만든다, GC root)
 
+    size_t bytesAllocated;
+    size_t nextGC; //다음 GC를 트리거할 heap 크기
     Obj *objects;
+    int grayCount;
+    int grayCapacity;
+    Obj **grayStack; //mark 되었지만 아직 참조를 추적하지 않은(gray) 객체들
+
+    FILE *out; //println 출력 (기본 stdout). 작업자 스레드에서는 스크립트별 버퍼
+    FILE *err; //컴파일/런타임 에러 메시지 (기본 stderr)
+
+    bool traceExecution; //--trace: 명령어마다 스택과 디스어셈블 결과를 출력하는 run loop로 실행
+    bool printCode; //--disasm: 컴파일이 끝난 chunk를 디스어셈블해서 출력
+    bool countInstructions; //--stats: dispatch된 명령어 수를 instructionCount에 센다
+    bool lazyCompile; //--lazy: 함수 본문은 처음 호출될 때 컴파일한다
+    uint64_t instructionCount;
+
+    //메인 스크립트의 스택은 고정 크기 (fiber의 스택은 heap에 있고 필요하면 늘어난다)
+    CallFrame rootFrames[FRAMES_MAX];
+    Value rootStack[STACK_MAX];
 } VM;
 
 typedef enum {
@@ -35,7 +76,17 @@ typedef enum {
     INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-extern VM vm;
+typedef struct {
+    const char *name;
+    NativeFn function;
+} NativeDef;
+
+//스레드마다 하나의 isolate: VM, 컴파일러, 스캐너, 할당 pool, 스냅샷 상태가 모두 스레드 로컬이다.
+//각 스레드는 자기 heap과 GC를 가지며 다른 스레드의 객체를 참조하지 않는다. initVM/freeVM도 그 스레드의 VM만 다룬다
+extern _Thread_local VM vm;
+
+extern const NativeDef natives[]; //initVM이 전역 변수로 정의하는 native 함수들
+extern const int nativeCount;
 
 
 void initVM();
@@ -44,8 +95,12 @@ void freeVM();
 
 InterpretResult interpret(const char *source);
 
+InterpretResult interpretFunction(ObjFunction *function);
+
 void push(Value value);
 
 Value pop();
 
+int globalSlot(ObjString *name);
+
 #endif //CLOX_VM_H